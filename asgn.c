@@ -1,74 +1,739 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
-#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "bloom.h"
 #include "htable.h"
+#include "sketch.h"
+#include "spill.h"
+#include "topk.h"
 #include "tree.h"
+#include "trie.h"
+#include "window.h"
 #include "mylib.h"
 
-typedef enum datastructure {TREE, HTABLE} datastructure_t;
+/* Longest word kept, longer words are split as getword splits them */
+#define WORD_LIMIT 256
+
+/* Load factor the per-thread tables of -j grow at when -g is not given */
+#define THREAD_MAX_LOAD 0.75
+
+/* Number of words -c looks up in one htable_search_batch call */
+#define SEARCH_BATCH 64
+
+/* Bytes of output print_info gathers before writing them out */
+#define OUT_BUFSIZE (1 << 20)
+
+/* Heaviest words -a prints when -k is not given */
+#define APPROX_TOP_K 20
+
+/* Heaviest words each snapshot of -W prints when -k is not given */
+#define WINDOW_TOP_K 10
+
+/* Load factor the table of -W grows at when -g is not given */
+#define WINDOW_MAX_LOAD 0.75
+
+typedef enum datastructure {TREE, HTABLE, TRIE} datastructure_t;
+
+/* Bloom filter of the counted words for -b, and the keys it is sized for */
+static bloom filter = NULL;
+static int filter_keys = 0;
+
+/* Output of print_info waiting to be written */
+static char out_buf[OUT_BUFSIZE];
+static size_t out_len = 0;
+
+/* The heaviest words seen so far, for -k */
+static topk top = NULL;
+
+/* A stretch of a stream, either a number of words or of seconds */
+struct span {
+    long words;
+    double secs;
+};
+
+/* A share of the input counted by one thread of -j, into a hash table
+   or into a tree */
+struct count_job {
+    long offset;
+    long len;
+    hashing_t method;
+    hashfn_t hashfn;
+    int capacity;
+    double max_load;
+    htable h;
+    htable src;
+    tree_t tree_type;
+    tree t;
+    tree t_src;
+};
+
+/* 
+ * Write out the output print_info has gathered.
+ */
+static void flush_info(void) {
+    fwrite(out_buf, 1, out_len, stdout);
+    out_len = 0;
+}
+
+/* 
+ * Print words added to the data structure alongside their frequencies,
+ * formatted as printf("%-4d %s\n") would. Lines are built by hand in a
+ * large buffer and written a buffer at a time, which is several times
+ * faster than a printf call per word. flush_info writes out the rest.
+ * @param frequency the frequency of a user-given word
+ * @param word a word to print information about
+ */
+static void print_info(int freq, char *word) {
+    char digits[12];
+    size_t len = strlen(word);
+    unsigned int f = (unsigned int) freq;
+    int n = 0, width;
+
+    if (out_len + len + sizeof digits + 2 > OUT_BUFSIZE) {
+        flush_info();
+        if (len + sizeof digits + 2 > OUT_BUFSIZE) {
+            printf("%-4d %s\n", freq, word);
+            return;
+        }
+    }
+
+    do {
+        digits[n++] = (char) ('0' + f % 10);
+        f /= 10;
+    } while (f != 0);
+    for (width = n; n > 0; ) {
+        out_buf[out_len++] = digits[--n];
+    }
+    for (; width < 4; width++) {
+        out_buf[out_len++] = ' ';
+    }
+    out_buf[out_len++] = ' ';
+    memcpy(out_buf + out_len, word, len);
+    out_len += len;
+    out_buf[out_len++] = '\n';
+}
+
+/* 
+ * Count a word towards the size of the Bloom filter.
+ * @param freq the frequency of the word
+ * @param word the word
+ */
+static void count_key(int freq, char *word) {
+    (void) freq;
+    (void) word;
+    filter_keys++;
+}
+
+/* 
+ * Add a word to the Bloom filter.
+ * @param freq the frequency of the word
+ * @param word the word
+ */
+static void add_to_filter(int freq, char *word) {
+    (void) freq;
+    bloom_add(filter, word);
+}
+
+/* 
+ * Offer a word to the heap of the heaviest words.
+ * @param freq the frequency of the word
+ * @param word the word
+ */
+static void add_to_top(int freq, char *word) {
+    topk_add(top, freq, word);
+}
+
+/* 
+ * Print a word found by approximate counting, with the range its true
+ * frequency lies in.
+ * @param estimate the estimated frequency of the word, never too low
+ * @param lower the least the frequency of the word can be
+ * @param word the word
+ */
+static void print_hitter(long estimate, long lower, char *word) {
+    printf("%-4ld %s [%ld, %ld]\n", estimate, word, lower, estimate);
+}
+
+/* 
+ * Read a number of bytes, optionally followed by K, M or G.
+ * @param str the string to read
+ * @return the number of bytes, or 0 if the string isn't one
+ */
+static long parse_size(char *str) {
+    char *end;
+    long n = strtol(str, &end, 10);
+
+    switch (*end) {
+        case 'K': case 'k':
+            n *= 1L << 10;
+            end++;
+            break;
+        case 'M': case 'm':
+            n *= 1L << 20;
+            end++;
+            break;
+        case 'G': case 'g':
+            n *= 1L << 30;
+            end++;
+            break;
+    }
+
+    return *end == '\0' && n > 0 ? n : 0;
+}
+
+/* 
+ * Count the words of stdin approximately in a fixed amount of memory and
+ * print the heaviest of them, with the sketch's error bound on stderr.
+ * @param budget the bytes the counts may take
+ * @param k the number of heaviest words to print
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the budget is too small
+ */
+static int count_approx(long budget, int k) {
+    hitters t = hitters_new(budget, k);
+    tokenizer words;
+    double fill_start, fill_end;
+    char *word;
+    sketch s;
+
+    if (t == NULL) {
+        fprintf(stderr, "Memory budget too small for %d words\n", k);
+        return EXIT_FAILURE;
+    }
+
+    fill_start = seconds();
+    words = tokenizer_new(stdin);
+    while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        hitters_add(t, word);
+    }
+    tokenizer_free(words);
+    fill_end = seconds();
+
+    hitters_print(t, print_hitter);
+
+    s = hitters_counts(t);
+    fprintf(stderr, "Fill time\t: %8.7f\n", fill_end - fill_start);
+    fprintf(stderr, "Sketch\t\t: %ld KB, %ld words, %d tracked\n",
+            hitters_size(t) / 1024, hitters_words(t), hitters_tracked(t));
+    fprintf(stderr, "Error bound\t: estimates within +%.0f of the true "
+            "frequency with probability %.3f\n", sketch_error(s),
+            sketch_confidence(s));
+    hitters_free(t);
+
+    return EXIT_SUCCESS;
+}
+
+/* 
+ * Read a stretch of a stream, a number of words or a number of seconds
+ * followed by s.
+ * @param str the string to read
+ * @param span set to the stretch read
+ * @return 1 if the string is one, 0 otherwise
+ */
+static int parse_span(char *str, struct span *span) {
+    char *end;
+    double n = strtod(str, &end);
+
+    span->words = 0;
+    span->secs = 0.0;
+    if (*end == 's' && end[1] == '\0' && n > 0.0) {
+        span->secs = n;
+    } else if (*end == '\0' && n >= 1.0) {
+        span->words = (long) n;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* 
+ * Print the heaviest words of a sliding window, after a line giving
+ * how many words have been read and how many are in the window, and
+ * write them straight out.
+ * @param h the hash table the window counts in
+ * @param w the window
+ * @param words_read the number of words read so far
+ * @param k the number of heaviest words to print
+ */
+static void print_window(htable h, window w, long words_read, int k) {
+    printf("# %ld words read, %ld in window\n", words_read, window_size(w));
+    top = topk_new(k);
+    htable_print(h, add_to_top);
+    topk_print(top, print_info);
+    topk_free(top);
+    flush_info();
+    fflush(stdout);
+}
+
+/* 
+ * Count the words of stdin over a sliding window, printing the heaviest
+ * words in the window at every interval and once more at the end of the
+ * input, so the input may be a stream that never ends. Words leaving
+ * the window are taken out of the counts one by one, so no snapshot is
+ * counted from scratch.
+ * @param h the hash table to count in
+ * @param span the length of the window
+ * @param every the interval between snapshots
+ * @param k the number of heaviest words each snapshot prints
+ */
+static void count_window(htable h, struct span span, struct span every,
+                         int k) {
+    window w = window_new(h, span.words, span.secs);
+    tokenizer words = tokenizer_new(stdin);
+    int timed = span.secs > 0.0 || every.secs > 0.0, printed = 0;
+    double start = seconds(), now = 0.0, next = every.secs;
+    long words_read = 0;
+    char *word;
+
+    while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        if (timed) {
+            now = seconds() - start;
+        }
+        window_add(w, word, now);
+        words_read++;
+
+        printed = (every.words > 0 && words_read % every.words == 0)
+            || (every.secs > 0.0 && now >= next);
+        if (printed) {
+            print_window(h, w, words_read, k);
+            while (every.secs > 0.0 && next <= now) {
+                next += every.secs;
+            }
+        }
+    }
+    tokenizer_free(words);
+
+    if (!printed) {
+        if (timed) {
+            window_expire(w, seconds() - start);
+        }
+        print_window(h, w, words_read, k);
+    }
+    window_free(w);
+}
+
+/* 
+ * Count the words of stdin within a memory budget, spilling the counts
+ * to disk whenever they outgrow it, and print every word in key order.
+ * @param budget the bytes the counts may take
+ * @param method the hashing method of the table
+ * @param hashfn the hash function of the table
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the disk couldn't be used
+ */
+static int count_external(long budget, hashing_t method, hashfn_t hashfn) {
+    spill s = spill_new((size_t) budget, method, hashfn);
+    tokenizer words = tokenizer_new(stdin);
+    int ok = 1;
+    char *word;
+
+    while (ok && tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        ok = spill_insert(s, word);
+    }
+    tokenizer_free(words);
+
+    if (!ok || !spill_print(s, print_info)) {
+        fprintf(stderr, "Failed to spill counts to disk\n");
+        spill_free(s);
+        return EXIT_FAILURE;
+    }
+    flush_info();
+    fprintf(stderr, "Spilled runs\t: %d\n", spill_runs(s));
+    spill_free(s);
+
+    return EXIT_SUCCESS;
+}
+
+/* 
+ * Print how the Bloom filter screened the words of -c.
+ * @param unknown_words the number of words found to be unknown
+ */
+static void print_filter_counts(int unknown_words) {
+    long checks, rejects;
+
+    bloom_counts(filter, &checks, &rejects);
+    fprintf(stderr, "Bloom filter\t: %ld KB, %ld rejected, %ld passed, "
+            "%ld false positives\n", bloom_size(filter) / 1024, rejects,
+            checks - rejects, unknown_words - rejects);
+}
+
+/*
+ * Count the words of one share of stdin into the job's hash table, which
+ * is created here unless the job shares one with other threads.
+ * @param arg the count_job describing the share
+ * @return NULL
+ */
+static void *count_range(void *arg) {
+    struct count_job *job = arg;
+    tokenizer words = tokenizer_new_range(stdin, job->offset, job->len);
+    char *word;
+
+    if (job->h == NULL) {
+        job->h = htable_new(job->capacity, job->method, job->hashfn);
+        htable_set_max_load(job->h, job->max_load);
+    }
+
+    while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        htable_insert(job->h, word);
+    }
+
+    tokenizer_free(words);
+    return NULL;
+}
+
+/*
+ * Merge one thread's hash table into another's and free it.
+ * @param arg the count_job whose src table is merged into its own
+ * @return NULL
+ */
+static void *merge_range(void *arg) {
+    struct count_job *job = arg;
+
+    htable_merge(job->h, job->src);
+    htable_free(job->src);
+    return NULL;
+}
 
 /*
- * Checks if a number given by the user is a prime number.
- * @param n a number to check
- * @return an integer indicating whether or not the number is a prime number
+ * Count the words of one share of stdin into a tree of the job's own.
+ * @param arg the count_job describing the share
+ * @return NULL
  */
-int is_prime(int n) {
+static void *count_tree_range(void *arg) {
+    struct count_job *job = arg;
+    tokenizer words = tokenizer_new_range(stdin, job->offset, job->len);
+    char *word;
+
+    job->t = tree_new(job->tree_type);
+    while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        job->t = tree_insert(job->t, word);
+        job->t = setColourBlack(job->t);
+    }
+
+    tokenizer_free(words);
+    return NULL;
+}
+
+/*
+ * Merge one thread's tree into another's and free it.
+ * @param arg the count_job whose t_src tree is merged into its own
+ * @return NULL
+ */
+static void *merge_tree_range(void *arg) {
+    struct count_job *job = arg;
+
+    job->t = tree_merge(job->t, job->t_src);
+    tree_free(job->t_src);
+    return NULL;
+}
+
+/*
+ * Run a function over jobs on their own threads and wait for them all.
+ * Jobs whose thread can't be started run on the calling thread.
+ * @param f the function to run
+ * @param jobs the jobs to pass to f
+ * @param n the number of jobs
+ */
+static void run_threads(void *f(void *), struct count_job **jobs, int n) {
+    pthread_t *ids = emalloc(n * sizeof ids[0]);
+    int *started = emalloc(n * sizeof started[0]);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        started[i] = pthread_create(&ids[i], NULL, f, jobs[i]) == 0;
+        if (!started[i]) {
+            f(jobs[i]);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (started[i]) {
+            pthread_join(ids[i], NULL);
+        }
+    }
+
+    free(ids);
+    free(started);
+}
+
+/*
+ * Split stdin at word boundaries into a share for each job, and list
+ * the jobs in a batch for run_threads.
+ * @param jobs the jobs to give shares to, zeroed first
+ * @param batch set to point at each job
+ * @param threads the number of jobs
+ * @return 1 on success, 0 if stdin is not a regular file
+ */
+static int split_input(struct count_job *jobs, struct count_job **batch,
+                       int threads) {
+    struct stat st;
+    long offset = 0, end;
     int i;
 
-    if (n < 2) {
+    if (fstat(fileno(stdin), &st) != 0 || !S_ISREG(st.st_mode)) {
         return 0;
     }
 
-    for (i = 2; i*i <= n; i++) {
-        if (n % i == 0) {
-            return 0;
-        }
+    memset(jobs, 0, threads * sizeof jobs[0]);
+    for (i = 0; i < threads; i++) {
+        end = i == threads - 1 ? (long) st.st_size
+            : tokenizer_boundary(stdin, (long) st.st_size / threads * (i + 1));
+        jobs[i].offset = offset;
+        jobs[i].len = end > offset ? end - offset : 0;
+        offset += jobs[i].len;
+        batch[i] = &jobs[i];
     }
 
     return 1;
 }
 
 /*
- * Returns the next highest prime greater than a given value.
- * @param i the base number
- * @return the next highest prime
+ * Merge the results of the jobs pairwise, a round at a time, until the
+ * first job holds them all. Each merge of a round runs on its own
+ * thread, with the src fields of the job merged into pointing at the
+ * results of the job merged from.
+ * @param f the function merging a job's src into its own results
+ * @param jobs the jobs whose results are merged
+ * @param batch room for a pointer to each job
+ * @param threads the number of jobs
  */
-int next_highest_prime(int i) {
-    int j;
+static void merge_pairwise(void *f(void *), struct count_job *jobs,
+                           struct count_job **batch, int threads) {
+    int i, n, stride;
 
-    for (j = i; ; j++) {
-        if (1 == is_prime(j)) {
-            return j;
+    for (stride = 1; stride < threads; stride *= 2) {
+        for (i = n = 0; i + stride < threads; i += 2 * stride) {
+            jobs[i].src = jobs[i + stride].h;
+            jobs[i].t_src = jobs[i + stride].t;
+            batch[n++] = &jobs[i];
         }
+        run_threads(f, batch, n);
     }
 }
 
-/* 
- * Print words added to the data structure alongside their frequencies.
- * @param frequency the frequency of a user-given word
- * @param word a word to print information about
+/*
+ * Count the words of stdin with several threads. The input is split at
+ * word boundaries, each thread counts its share into its own hash table
+ * and the tables are merged pairwise. With shared set the threads all
+ * insert into one concurrent table of fixed capacity instead, and there
+ * is nothing to merge. Timings for each phase are printed to stderr.
+ * @param threads the number of threads to use
+ * @param method the hashing method of the tables
+ * @param hashfn the hash function of the tables
+ * @param capacity the starting capacity of each table
+ * @param max_load the load factor the tables grow at
+ * @param shared whether the threads share one concurrent table
+ * @return the merged hash table, or NULL if stdin is not a regular file
  */
-static void print_info(int freq, char *word) {
-    printf("%-4d %s\n", freq, word);
+static htable count_parallel(int threads, hashing_t method, hashfn_t hashfn,
+                             int capacity, double max_load, int shared) {
+    struct count_job *jobs = emalloc(threads * sizeof jobs[0]);
+    struct count_job **batch = emalloc(threads * sizeof batch[0]);
+    double split_start, count_start, merge_start, merge_end;
+    htable h = NULL;
+    int i;
+
+    split_start = seconds();
+    if (split_input(jobs, batch, threads)) {
+        h = shared ? htable_new_concurrent(capacity, method, hashfn) : NULL;
+        for (i = 0; i < threads; i++) {
+            jobs[i].method = method;
+            jobs[i].hashfn = hashfn;
+            jobs[i].capacity = capacity;
+            jobs[i].max_load = max_load;
+            jobs[i].h = h;
+        }
+
+        count_start = seconds();
+        run_threads(count_range, batch, threads);
+
+        merge_start = seconds();
+        if (!shared) {
+            merge_pairwise(merge_range, jobs, batch, threads);
+        }
+        merge_end = seconds();
+
+        fprintf(stderr, "Split time\t: %8.7f\n", count_start - split_start);
+        fprintf(stderr, "Count time\t: %8.7f\n", merge_start - count_start);
+        if (!shared) {
+            fprintf(stderr, "Merge time\t: %8.7f\n", merge_end - merge_start);
+        }
+        h = jobs[0].h;
+    }
+
+    free(jobs);
+    free(batch);
+
+    return h;
 }
 
 /*
- * Generate a text block for message help within the terminal.
+ * Count the words of stdin into a tree with several threads. The input
+ * is split at word boundaries, each thread counts its share into a tree
+ * of its own and the trees are merged pairwise. Timings for each phase
+ * are printed to stderr.
+ * @param threads the number of threads to use
+ * @param type the type of the trees
+ * @return the merged tree, or NULL if stdin is not a regular file
  */
-static void print_help() {
-    printf("HELP MESSAGE XD\n");
+static tree count_tree_parallel(int threads, tree_t type) {
+    struct count_job *jobs = emalloc(threads * sizeof jobs[0]);
+    struct count_job **batch = emalloc(threads * sizeof batch[0]);
+    double split_start, count_start, merge_start, merge_end;
+    tree t = NULL;
+    int i;
+
+    split_start = seconds();
+    if (split_input(jobs, batch, threads)) {
+        for (i = 0; i < threads; i++) {
+            jobs[i].tree_type = type;
+        }
+
+        count_start = seconds();
+        run_threads(count_tree_range, batch, threads);
+
+        merge_start = seconds();
+        merge_pairwise(merge_tree_range, jobs, batch, threads);
+        merge_end = seconds();
+
+        fprintf(stderr, "Split time\t: %8.7f\n", count_start - split_start);
+        fprintf(stderr, "Count time\t: %8.7f\n", merge_start - count_start);
+        fprintf(stderr, "Merge time\t: %8.7f\n", merge_end - merge_start);
+        t = jobs[0].t;
+    }
+
+    free(jobs);
+    free(batch);
+
+    return t;
+}
+
+/*
+ * Print every word of a file that is not in a hash table. Words are
+ * copied out of the tokenizer in batches so that htable_search_batch
+ * can overlap the cache misses of the lookups. Words the Bloom filter
+ * rules out, if there is one, never reach the table.
+ * @param h the hash table to check against
+ * @param words the tokenizer reading the file to check
+ * @return the number of unknown words
+ */
+static int check_words(htable h, tokenizer words) {
+    char batch[SEARCH_BATCH][WORD_LIMIT];
+    char *batch_words[SEARCH_BATCH];
+    int passed[SEARCH_BATCH], found[SEARCH_BATCH], freqs[SEARCH_BATCH];
+    int i, m, len, n = 0, unknown_words = 0;
+    char *word;
+
+    do {
+        len = tokenizer_next(words, &word, WORD_LIMIT);
+        if (len != EOF) {
+            memcpy(batch[n++], word, len + 1);
+        }
+
+        if (n == SEARCH_BATCH || (len == EOF && n > 0)) {
+            for (i = m = 0; i < n; i++) {
+                freqs[i] = 0;
+                if (filter == NULL || bloom_check(filter, batch[i])) {
+                    batch_words[m] = batch[i];
+                    passed[m++] = i;
+                }
+            }
+            htable_search_batch(h, batch_words, m, found);
+            for (i = 0; i < m; i++) {
+                freqs[passed[i]] = found[i];
+            }
+
+            for (i = 0; i < n; i++) {
+                if (freqs[i] == 0) {
+                    printf("%s\n", batch[i]);
+                    unknown_words++;
+                }
+            }
+            n = 0;
+        }
+    } while (len != EOF);
+
+    return unknown_words;
+}
+
+/*
+ * Generate a text block for message help within the terminal, listing
+ * every option.
+ */
+static void print_help(void) {
+    static const char *lines[] = {
+        "Usage: asgn [OPTION]... < FILE",
+        "",
+        "Count the words read from stdin and print each with its frequency.",
+        "Options that tune one structure are ignored unless given after the",
+        "option choosing it.",
+        "",
+        " -T          Use a binary search tree instead of a hash table",
+        " -D          Print hash function diagnostics instead of the words",
+        " -P          Use an adaptive radix trie instead of a hash table",
+        " -a SIZE     Count approximately in SIZE bytes, printing the heaviest",
+        "             words. SIZE may end in K, M or G",
+        " -b RATE     Screen -c lookups with a Bloom filter of false positive",
+        "             rate RATE",
+        " -c FILE     Print the words of FILE not counted from stdin, with",
+        "             timings on stderr",
+        " -E SPAN     Print -W results every SPAN words, or seconds with s",
+        " -d          Use double hashing instead of linear probing",
+        " -e          Print the entire hash table to stderr",
+        " -g LOAD     Grow the hash table once it is LOAD full",
+        " -H NAME     Hash with poly31, fnv1a, wordmix or siphash",
+        " -J FILE     Write operation counters to FILE as JSON, which needs a",
+        "             build with -DINSTRUMENT",
+        " -j N        Count with N threads, merging their results",
+        " -k K        Print only the K most frequent words",
+        " -l FILE     Check -c words against a snapshot loaded from FILE",
+        " -M SIZE     Count in SIZE bytes of memory, spilling runs to disk.",
+        "             SIZE may end in K, M or G",
+        " -O ORDER    Print the words sorted by key or by freq",
+        " -o          Write the tree to tree-view.dot in DOT format",
+        " -p          Print hash table statistics instead of the words",
+        " -R          Use Robin Hood hashing instead of linear probing",
+        " -r          Make the tree a red-black tree",
+        " -S          Count with -j threads sharing one concurrent table",
+        " -s N        Print N snapshots of the statistics of -p",
+        " -t SIZE     Start the hash table with at least SIZE slots",
+        " -W SPAN     Print the heaviest words of each window of SPAN words,",
+        "             or seconds with s",
+        " -w FILE     Save a snapshot of the counts to FILE for -l",
+        " -x FILE     Leave out the words of FILE",
+        " -h          Print this help",
+        NULL
+    };
+    int i;
+
+    for (i = 0; lines[i] != NULL; i++) {
+        printf("%s\n", lines[i]);
+    }
 }
 
 int main(int argc, char **argv) {
-    const char *optstring = "Tc:deoprs:t:h";
+    const char *optstring = "TDPa:b:c:E:deg:H:J:j:k:l:M:O:opRrSs:t:W:w:x:h";
     char option;
     datastructure_t datastructure = HTABLE;
     FILE *file_to_check = NULL;
     FILE *tree_view = NULL;
+    FILE *snapshot_out = NULL;
+    FILE *counters_out = NULL;
+    FILE *stop_words = NULL;
+    char *snapshot_in = NULL;
     hashing_t hashing_method = LINEAR_P;
+    hashfn_t hashfn = POLY31;
     tree_t tree_type = BST;
     int htable_capacity = 113, snapshots = 10;
+    int print_entire = 0, print_stats = 0, print_diagnostics = 0;
+    int threads = 1, shared = 0, top_k = 0, sorted = 0;
+    order_t order = BY_KEY;
+    double max_load = 0.0, fp_rate = 0.0;
+    long budget = 0, spill_budget = 0;
+    struct span span = {0, 0.0}, every = {0, 0.0};
 
     /* Statements here represent command-line arguments with corresponding actions */
     while ((option = getopt(argc, argv, optstring)) != EOF) {
@@ -76,6 +741,25 @@ int main(int argc, char **argv) {
             case 'T':
                 datastructure = TREE;
                 break;
+            case 'P':
+                datastructure = TRIE;
+                break;
+            case 'D':
+                if (file_to_check == NULL && datastructure == HTABLE) {
+                    print_diagnostics = 1;
+                }
+                break;
+            case 'a':
+                budget = parse_size(optarg);
+
+                if (budget == 0) {
+                    fprintf(stderr, "Bad memory budget: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                fp_rate = atof(optarg);
+                break;
             case 'c':
                 file_to_check = fopen(optarg, "r");
 
@@ -84,6 +768,12 @@ int main(int argc, char **argv) {
                     return EXIT_FAILURE;
                 }
                 
+                break;
+            case 'E':
+                if (!parse_span(optarg, &every)) {
+                    fprintf(stderr, "Bad interval: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
                 break;
             case 'd':
                 if (datastructure == HTABLE) {
@@ -92,7 +782,61 @@ int main(int argc, char **argv) {
                 break;
             case 'e':
                 if (datastructure == HTABLE) {
-                    htable_print_entire_table(h);
+                    print_entire = 1;
+                }
+                break;
+            case 'g':
+                if (datastructure == HTABLE) {
+                    max_load = atof(optarg);
+                }
+                break;
+            case 'H':
+                if (datastructure == HTABLE
+                        && !htable_parse_hashfn(optarg, &hashfn)) {
+                    fprintf(stderr, "Unknown hash function: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'J':
+                counters_out = fopen(optarg, "w");
+
+                if (counters_out == NULL) {
+                    fprintf(stderr, "Failed to open file: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                if (datastructure != TRIE) {
+                    threads = atoi(optarg);
+                }
+                break;
+            case 'k':
+                top_k = atoi(optarg);
+                break;
+            case 'l':
+                snapshot_in = optarg;
+                break;
+            case 'M':
+                if (datastructure == HTABLE) {
+                    spill_budget = parse_size(optarg);
+
+                    if (spill_budget == 0) {
+                        fprintf(stderr, "Bad memory budget: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'O':
+                if (datastructure == HTABLE) {
+                    sorted = 1;
+                    if (strcmp(optarg, "key") == 0) {
+                        order = BY_KEY;
+                    } else if (strcmp(optarg, "freq") == 0) {
+                        order = BY_FREQ;
+                    } else {
+                        fprintf(stderr, "Unknown order: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
                 }
                 break;
             case 'o':
@@ -107,7 +851,12 @@ int main(int argc, char **argv) {
                 break;
             case 'p':
                 if (file_to_check == NULL && datastructure == HTABLE) {
-                    /* print-stats.txt*/
+                    print_stats = 1;
+                }
+                break;
+            case 'R':
+                if (datastructure == HTABLE) {
+                    hashing_method = ROBIN_HOOD;
                 }
                 break;
             case 'r':
@@ -115,6 +864,11 @@ int main(int argc, char **argv) {
                     tree_type = RBT;
                 }
                 break;
+            case 'S':
+                if (datastructure == HTABLE) {
+                    shared = 1;
+                }
+                break;
             case 's':
                 if (datastructure == HTABLE) {
                     snapshots = atoi(optarg);
@@ -125,47 +879,307 @@ int main(int argc, char **argv) {
                     htable_capacity = next_highest_prime(atoi(optarg));
                 }
                 break;
+            case 'W':
+                if (datastructure == HTABLE && !parse_span(optarg, &span)) {
+                    fprintf(stderr, "Bad window: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w':
+                snapshot_out = fopen(optarg, "wb");
+
+                if (snapshot_out == NULL) {
+                    fprintf(stderr, "Failed to open file: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'x':
+                stop_words = fopen(optarg, "r");
+
+                if (stop_words == NULL) {
+                    fprintf(stderr, "Failed to open file: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case 'h':
                 print_help();
-                break;
+                return EXIT_SUCCESS;
+        }
+    }
+    if (snapshot_in != NULL && file_to_check == NULL) {
+        fprintf(stderr, "A loaded snapshot can only be used with -c\n");
+        return EXIT_FAILURE;
+    }
+    if (budget > 0) { /* approximate counts in bounded memory */
+        return count_approx(budget, top_k > 0 ? top_k : APPROX_TOP_K);
+    }
+    if (span.words > 0 || span.secs > 0.0) { /* counts over a window */
+        htable h = htable_new(htable_capacity, hashing_method, hashfn);
+
+        htable_set_max_load(h, max_load > 0 ? max_load : WINDOW_MAX_LOAD);
+        if (every.words == 0 && every.secs == 0.0) {
+            every = span;
         }
+        count_window(h, span, every, top_k > 0 ? top_k : WINDOW_TOP_K);
+        htable_free(h);
+        return EXIT_SUCCESS;
+    }
+    if (spill_budget > 0) { /* counts too large for memory */
+        return count_external(spill_budget, hashing_method, hashfn);
     }
     /* Hash Table generation */
-    if (datastructure = HTABLE) { 
+    if (datastructure == HTABLE) { 
         char *word;
-        int unknown_words = 0, i;
-        clock_t fill_start, fill_end, search_start, search_end;
-        htable h = htable_new(htable_capacity, hashing_method);
+        int unknown_words = 0;
+        double fill_start, fill_end, search_start, search_end;
+        htable h = NULL;
+        tokenizer words;
+
+        fill_start = seconds();
+        if (snapshot_in != NULL) {
+            h = htable_load(snapshot_in);
+
+            if (h == NULL) {
+                fprintf(stderr, "Failed to load snapshot: %s\n", snapshot_in);
+                return EXIT_FAILURE;
+            }
+        } else if (threads > 1 || (threads == 1 && shared)) {
+            h = count_parallel(threads, hashing_method, hashfn,
+                               htable_capacity,
+                               max_load > 0 ? max_load : THREAD_MAX_LOAD,
+                               shared);
+        }
+        if (h == NULL) { /* single threaded, or stdin can't be split */
+            h = htable_new(htable_capacity, hashing_method, hashfn);
+            htable_set_max_load(h, max_load);
+
+            words = tokenizer_new(stdin);
+            while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+                htable_insert(h, word);
+            }
+            tokenizer_free(words);
+        }
+        if (stop_words != NULL && snapshot_in == NULL) {
+            words = tokenizer_new(stop_words);
+            while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+                htable_delete(h, word);
+            }
+            tokenizer_free(words);
+            fclose(stop_words);
+        }
+        if (fp_rate > 0.0 && file_to_check != NULL && snapshot_in == NULL) {
+            htable_print(h, count_key);
+            filter = bloom_new(filter_keys, fp_rate);
+            htable_print(h, add_to_filter);
+        }
+        fill_end = seconds();
 
-        fill_start = clock();
-        while (getword(word, sizeof word, stdin) != EOF) {
-            htable_insert(h, word);
+        if (snapshot_out != NULL) {
+            if (!htable_save(h, snapshot_out)) {
+                fprintf(stderr, "Failed to write snapshot\n");
+                return EXIT_FAILURE;
+            }
+            fclose(snapshot_out);
         }
-        fill_end = clock();
 
-        
+        if (print_entire && file_to_check == NULL) {
+            htable_print_entire_table(h, stderr);
+        }
 
         if (file_to_check != NULL) { /* -c filename AND NOT -o or -p */
-            search_start = clock();
-            while (getword(word, sizeof word, file_to_check) != EOF) {
-                if (htable_search(h, word) == 0) {
+            words = tokenizer_new(file_to_check);
+
+            search_start = seconds();
+            unknown_words = check_words(h, words);
+            search_end = seconds();
+            tokenizer_free(words);
+
+            fprintf(stderr, "Fill time\t: %8.7f\n", fill_end - fill_start);
+            fprintf(stderr, "Search time\t: %8.7f\n",
+                    search_end - search_start);
+            fprintf(stderr, "Unknown words = %d\n", unknown_words);
+            if (filter != NULL) {
+                print_filter_counts(unknown_words);
+            }
+        } else if (print_stats || print_diagnostics) {
+            if (print_stats) {
+                htable_print_stats(h, stdout, snapshots);
+            }
+            if (print_diagnostics) {
+                htable_print_diagnostics(h, stdout);
+            }
+        } else if (top_k > 0) { /* only the heaviest words */
+            top = topk_new(top_k);
+            htable_print(h, add_to_top);
+            topk_print(top, print_info);
+            topk_free(top);
+        } else if (sorted) {
+            htable_print_sorted(h, order, print_info);
+        } else { /* NO -c filename so print normally */
+            htable_print(h, print_info);
+        }
+
+        if (counters_out != NULL) {
+            htable_print_counters(h, counters_out);
+            fclose(counters_out);
+        }
+        htable_free(h);
+    } else if (datastructure == TRIE) {
+        char *word;
+        int unknown_words = 0;
+        double fill_start, fill_end, search_start, search_end;
+        trie t = trie_new();
+        tokenizer words = tokenizer_new(stdin);
+
+        fill_start = seconds();
+        while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+            t = trie_insert(t, word);
+        }
+        tokenizer_free(words);
+        if (fp_rate > 0.0 && file_to_check != NULL) {
+            trie_preorder(t, count_key);
+            filter = bloom_new(filter_keys, fp_rate);
+            trie_preorder(t, add_to_filter);
+        }
+        fill_end = seconds();
+
+        if (file_to_check != NULL) {
+            words = tokenizer_new(file_to_check);
+
+            search_start = seconds();
+            while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+                if ((filter != NULL && !bloom_check(filter, word))
+                        || trie_search(t, word) == 0) {
                     printf("%s\n", word);
                     unknown_words++;
                 }
             }
-            search_end = clock();
+            search_end = seconds();
+            tokenizer_free(words);
 
-            fprintf(stderr, "Fill time\t: %8.7f\n",
-                    (fill_start - fill_end) / (double) CLOCKS_PER_SEC);
+            fprintf(stderr, "Fill time\t: %8.7f\n", fill_end - fill_start);
             fprintf(stderr, "Search time\t: %8.7f\n",
-                    (search_start - search_end) / (double) CLOCKS_PER_SEC);
+                    search_end - search_start);
             fprintf(stderr, "Unknown words = %d\n", unknown_words);
-        } else { /* NO -c filename so print normally */
-            htable_print(h, print_info);
+            if (filter != NULL) {
+                print_filter_counts(unknown_words);
+            }
+        } else if (top_k > 0) { /* only the heaviest words */
+            top = topk_new(top_k);
+            trie_preorder(t, add_to_top);
+            topk_print(top, print_info);
+            topk_free(top);
+        } else { /* words come out of the trie in key order */
+            trie_preorder(t, print_info);
+        }
+
+        if (counters_out != NULL) {
+            trie_print_counters(t, counters_out);
+            fclose(counters_out);
         }
+        trie_free(t);
     } else { /* TREES */
-        
+        char *word;
+        int unknown_words = 0;
+        double fill_start, fill_end, search_start, search_end;
+        tree t = NULL;
+        frozen_tree frozen = NULL;
+        tokenizer words = tokenizer_new(stdin);
+
+        fill_start = seconds();
+        if (snapshot_in != NULL) {
+            frozen = tree_frozen_load(snapshot_in);
+
+            if (frozen == NULL) {
+                fprintf(stderr, "Failed to load snapshot: %s\n", snapshot_in);
+                return EXIT_FAILURE;
+            }
+        } else if (threads > 1) {
+            t = count_tree_parallel(threads, tree_type);
+        }
+        if (t == NULL) { /* single threaded, or stdin can't be split */
+            t = tree_new(tree_type);
+            while (snapshot_in == NULL
+                   && tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+                t = tree_insert(t, word);
+                t = setColourBlack(t);
+            }
+        }
+        if (stop_words != NULL && snapshot_in == NULL) {
+            tokenizer stop = tokenizer_new(stop_words);
+
+            while (tokenizer_next(stop, &word, WORD_LIMIT) != EOF) {
+                t = tree_delete(t, word);
+            }
+            tokenizer_free(stop);
+            fclose(stop_words);
+        }
+        if (fp_rate > 0.0 && file_to_check != NULL && snapshot_in == NULL) {
+            tree_preorder(t, count_key);
+            filter = bloom_new(filter_keys, fp_rate);
+            tree_preorder(t, add_to_filter);
+        }
+        if (frozen == NULL && (file_to_check != NULL || snapshot_out != NULL)) {
+            frozen = tree_freeze(t); /* -c only reads, so freeze the tree */
+        }
+        fill_end = seconds();
+
+        if (snapshot_out != NULL) {
+            if (!tree_frozen_save(frozen, snapshot_out)) {
+                fprintf(stderr, "Failed to write snapshot\n");
+                return EXIT_FAILURE;
+            }
+            fclose(snapshot_out);
+        }
+        tokenizer_free(words);
+
+        if (file_to_check != NULL) { /* -c filename AND NOT -o */
+            words = tokenizer_new(file_to_check);
+
+            search_start = seconds();
+            while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+                if ((filter != NULL && !bloom_check(filter, word))
+                        || tree_frozen_search(frozen, word) == 0) {
+                    printf("%s\n", word);
+                    unknown_words++;
+                }
+            }
+            search_end = seconds();
+            tokenizer_free(words);
+
+            fprintf(stderr, "Fill time\t: %8.7f\n", fill_end - fill_start);
+            fprintf(stderr, "Search time\t: %8.7f\n",
+                    search_end - search_start);
+            fprintf(stderr, "Unknown words = %d\n", unknown_words);
+            if (filter != NULL) {
+                print_filter_counts(unknown_words);
+            }
+        } else if (tree_view != NULL) {
+            tree_output_dot(t, tree_view);
+            fclose(tree_view);
+        } else if (top_k > 0) { /* only the heaviest words */
+            top = topk_new(top_k);
+            tree_preorder(t, add_to_top);
+            topk_print(top, print_info);
+            topk_free(top);
+        } else { /* NO -c filename so print normally */
+            tree_preorder(t, print_info);
+        }
+
+        if (counters_out != NULL) {
+            tree_print_counters(t, counters_out);
+            fclose(counters_out);
+        }
+        if (frozen != NULL) {
+            tree_frozen_free(frozen);
+        }
+        tree_free(t);
+    }
+
+    if (filter != NULL) {
+        bloom_free(filter);
     }
+    flush_info();
 
     return EXIT_SUCCESS;
 }
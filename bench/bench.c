@@ -0,0 +1,951 @@
+/*
+ * Benchmark the word counting data structures on generated corpora.
+ *
+ * Build from the top of the repository with
+ *
+ *    gcc -O2 -pthread -o bench-run bench/bench.c htable.c tree.c trie.c \\
+ *        sketch.c mylib.c -lm
+ *
+ * Each run fills a structure with a stream of words and then searches
+ * it with a shuffled mix of present and absent words, timing both
+ * phases with the monotonic clock. Every combination is repeated and
+ * reported by its fastest and median times, as CSV by default or JSON
+ * with -f json, so results from different versions can be compared.
+ * With -C the queries are timed a second time after heavy churn, which
+ * leaves the same keys in the structure but shuffles where they sit,
+ * tombstones and all. The sketch structure counts approximately in a
+ * fixed budget of memory, as asgn -a does, for comparison with the
+ * exact structures; its searches may find absent words. Each result
+ * also gives the bytes the structure held once filled, keys included.
+ *
+ * Options:
+ *    -w LIST   workloads: uniform, zipf, sorted, adversarial
+ *    -d LIST   structures: lp, dh, rh, bst, rbt, frozen, art, sketch
+ *    -n LIST   numbers of distinct keys
+ *    -l LIST   load factors of the hash tables, between 0 and 1
+ *    -r REPS   runs of each combination
+ *    -s SEED   seed for the corpus generator
+ *    -z S      exponent of the Zipf distribution
+ *    -H NAME   hash function of the tables, as for asgn -H
+ *    -i FILE   also run on the words of FILE
+ *    -B BYTES  memory budget of the sketch structure
+ *    -C ROUNDS after timing the queries, delete and reinsert a random
+ *              half of the keys this many times and time them again
+ *    -f FORMAT csv or json
+ *    -t TAG    label every result, e.g. with a commit id
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../htable.h"
+#include "../sketch.h"
+#include "../tree.h"
+#include "../trie.h"
+#include "../mylib.h"
+
+/* Longest word kept from a -i file */
+#define WORD_LIMIT 256
+
+/* Most entries in a comma separated option list */
+#define LIST_MAX 32
+
+/* Tokens in the uniform and Zipf streams, per distinct key */
+#define STREAM_FACTOR 4
+
+/* Adversarial keys all hash into this fraction of the home slots */
+#define ADVERSARIAL_SPREAD 64
+
+/* Largest sorted input fed to a plain BST, which is quadratic on it */
+#define BST_SORTED_MAX 20000
+
+/* Memory budget of the sketch structure when -B is not given */
+#define SKETCH_BUDGET (1L << 20)
+
+/* Heaviest words the sketch structure is sized to report */
+#define SKETCH_TOP_K 20
+
+typedef enum workload_e {UNIFORM, ZIPF, SORTED, ADVERSARIAL, FILE_WORDS}
+    workload_t;
+
+static const char *workload_names[] = {
+    "uniform", "zipf", "sorted", "adversarial", "file"
+};
+
+/* A structure under test */
+struct structure {
+    const char *name;
+    int is_table;
+    hashing_t method;
+    tree_t type;
+    int frozen;
+    int approx;
+    int radix;
+};
+
+static const struct structure structures[] = {
+    {"lp", 1, LINEAR_P, BST, 0, 0, 0},
+    {"dh", 1, DOUBLE_H, BST, 0, 0, 0},
+    {"rh", 1, ROBIN_HOOD, BST, 0, 0, 0},
+    {"bst", 0, LINEAR_P, BST, 0, 0, 0},
+    {"rbt", 0, LINEAR_P, RBT, 0, 0, 0},
+    {"frozen", 0, LINEAR_P, RBT, 1, 0, 0},
+    {"art", 0, LINEAR_P, BST, 0, 0, 1},
+    {"sketch", 0, LINEAR_P, BST, 0, 1, 0}
+};
+
+#define NUM_STRUCTURES ((int) (sizeof structures / sizeof structures[0]))
+
+/* The words of one benchmark: a stream to fill with, its distinct
+   keys, and queries to search for, the first num_hits of which were in
+   the stream */
+struct corpus {
+    arena words;
+    char **stream;
+    int num_stream;
+    char **keys;
+    int distinct;
+    char **queries;
+    int num_queries;
+    int num_hits;
+};
+
+/* The timings of one combination, one per run, and the bytes the
+   structure held after the last fill */
+struct result {
+    double *fill;
+    double *search;
+    double *churn;
+    double *churned;
+    int reps;
+    int rounds;
+    size_t bytes;
+};
+
+static uint64_t rng_state = 88172645463325252u;
+
+/*
+ * Draw the next number from a xorshift64* generator. The generator is
+ * our own so corpora are the same on every platform for a given seed.
+ * @return a uniformly distributed 64-bit number
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return rng_state * UINT64_C(2685821657736338717);
+}
+
+/*
+ * Draw a number uniformly from [0, 1).
+ * @return the number
+ */
+static double rng_uniform(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Make a random lowercase word of 4 to 12 letters.
+ * @param buf where to write the word, at least 13 bytes
+ */
+static void random_word(char *buf) {
+    int len = 4 + (int) (rng_next() % 9), i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = 'a' + (char) (rng_next() % 26);
+    }
+    buf[len] = '\0';
+}
+
+/*
+ * The 31 * h + c hash the tables use by default, so adversarial keys
+ * can be aimed at their home slots.
+ * @param str the string to hash
+ * @return the hash
+ */
+static unsigned int poly31(char *str) {
+    unsigned int out = 0;
+
+    while (*str != '\0') {
+        out = (*str++ + 31 * out);
+    }
+
+    return out;
+}
+
+/*
+ * Compare two strings through pointers to them, for qsort.
+ */
+static int compare_words(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Shuffle an array of words in place.
+ * @param words the words
+ * @param n the number of words
+ */
+static void shuffle(char **words, int n) {
+    char *temp;
+    int i, j;
+
+    for (i = n - 1; i > 0; i--) {
+        j = (int) (rng_next() % (i + 1));
+        temp = words[i];
+        words[i] = words[j];
+        words[j] = temp;
+    }
+}
+
+/*
+ * Draw a rank from a Zipf distribution, by binary search of the
+ * cumulative distribution.
+ * @param cdf the cumulative probabilities of ranks 0 to n - 1
+ * @param n the number of ranks
+ * @return the rank drawn
+ */
+static int zipf_rank(double *cdf, int n) {
+    double u = rng_uniform();
+    int lo = 0, hi = n - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * Collect the distinct words of the stream of a corpus, in sorted order.
+ * @param c the corpus, with its stream made
+ */
+static void collect_keys(struct corpus *c) {
+    int i, n = 0;
+
+    c->keys = emalloc((c->num_stream + 1) * sizeof c->keys[0]);
+    memcpy(c->keys, c->stream, c->num_stream * sizeof c->keys[0]);
+    qsort(c->keys, c->num_stream, sizeof c->keys[0], compare_words);
+
+    for (i = 0; i < c->num_stream; i++) {
+        if (n == 0 || strcmp(c->keys[n - 1], c->keys[i]) != 0) {
+            c->keys[n++] = c->keys[i];
+        }
+    }
+    c->distinct = n;
+}
+
+/*
+ * Fill in the queries of a corpus: one hit drawn from the stream for
+ * every distinct word, as many misses, shuffled together. Misses start
+ * with a digit so they can never be in a stream of generated words.
+ * @param c the corpus, with its stream made
+ * @param sample the words to draw hits from
+ * @param n the number of words to draw from
+ */
+static void make_queries(struct corpus *c, char **sample, int n) {
+    char buf[16];
+    int i;
+
+    c->num_hits = c->distinct;
+    c->num_queries = 2 * c->distinct;
+    c->queries = emalloc(c->num_queries * sizeof c->queries[0]);
+
+    for (i = 0; i < c->num_hits; i++) {
+        c->queries[i] = sample[rng_next() % n];
+    }
+    for (; i < c->num_queries; i++) {
+        buf[0] = '0' + (char) (rng_next() % 10);
+        random_word(buf + 1);
+        c->queries[i] = arena_strdup(c->words, buf);
+    }
+    shuffle(c->queries, c->num_queries);
+}
+
+/*
+ * Generate a corpus.
+ * @param w the shape of the corpus
+ * @param keys the number of distinct keys wanted
+ * @param capacity the table capacity adversarial keys are aimed at
+ * @param zipf_s the exponent of the Zipf distribution
+ * @param seed the seed of the generator
+ * @return the corpus
+ */
+static struct corpus *make_corpus(workload_t w, int keys, int capacity,
+                                  double zipf_s, uint64_t seed) {
+    struct corpus *c = emalloc(sizeof *c);
+    char **vocab = emalloc(keys * sizeof vocab[0]);
+    double *cdf, total = 0.0;
+    unsigned int spread = capacity / ADVERSARIAL_SPREAD + 1;
+    char buf[16];
+    int i;
+
+    rng_state = seed != 0 ? seed : 1;
+    c->words = arena_new();
+
+    for (i = 0; i < keys; i++) {
+        do {
+            random_word(buf);
+        } while (w == ADVERSARIAL && poly31(buf) % capacity >= spread);
+        vocab[i] = arena_strdup(c->words, buf);
+    }
+
+    if (w == UNIFORM || w == ZIPF) {
+        c->num_stream = STREAM_FACTOR * keys;
+        c->stream = emalloc(c->num_stream * sizeof c->stream[0]);
+        cdf = emalloc(keys * sizeof cdf[0]);
+
+        for (i = 0; i < keys; i++) {
+            total += pow(i + 1, -zipf_s);
+            cdf[i] = total;
+        }
+        for (i = 0; i < keys; i++) {
+            cdf[i] /= total;
+        }
+        for (i = 0; i < c->num_stream; i++) {
+            c->stream[i] = vocab[w == ZIPF ? zipf_rank(cdf, keys)
+                                 : (int) (rng_next() % keys)];
+        }
+        free(cdf);
+
+        collect_keys(c);
+        make_queries(c, c->stream, c->num_stream);
+        free(vocab);
+    } else {
+        if (w == SORTED) {
+            qsort(vocab, keys, sizeof vocab[0], compare_words);
+        }
+        c->stream = vocab;
+        c->num_stream = keys;
+        collect_keys(c);
+        make_queries(c, vocab, keys);
+    }
+
+    return c;
+}
+
+/*
+ * Read a corpus from the words of a file.
+ * @param path the file
+ * @param seed the seed used to draw queries
+ * @return the corpus, or NULL if the file can't be read
+ */
+static struct corpus *load_corpus(char *path, uint64_t seed) {
+    FILE *in = fopen(path, "r");
+    struct corpus *c;
+    tokenizer words;
+    char *word;
+    int max = 1024;
+
+    if (in == NULL) {
+        return NULL;
+    }
+
+    rng_state = seed != 0 ? seed : 1;
+    c = emalloc(sizeof *c);
+    c->words = arena_new();
+    c->num_stream = 0;
+    c->stream = emalloc(max * sizeof c->stream[0]);
+
+    words = tokenizer_new(in);
+    while (tokenizer_next(words, &word, WORD_LIMIT) != EOF) {
+        if (c->num_stream == max) {
+            max *= 2;
+            c->stream = erealloc(c->stream, max * sizeof c->stream[0]);
+        }
+        c->stream[c->num_stream++] = arena_strdup(c->words, word);
+    }
+    tokenizer_free(words);
+    fclose(in);
+
+    collect_keys(c);
+
+    if (c->num_stream == 0) {
+        c->num_hits = c->num_queries = 0;
+        c->queries = NULL;
+    } else {
+        make_queries(c, c->stream, c->num_stream);
+    }
+
+    return c;
+}
+
+/*
+ * Free a corpus.
+ * @param c the corpus to free
+ */
+static void free_corpus(struct corpus *c) {
+    arena_free(c->words);
+    free(c->stream);
+    free(c->keys);
+    free(c->queries);
+    free(c);
+}
+
+/*
+ * Pick the keys a round of churn deletes and reinserts: a random half of
+ * them, the same for every structure.
+ * @param c the corpus
+ * @param order room for the distinct keys, set to them in random order
+ * @param round the number of the round
+ */
+static void churn_keys(struct corpus *c, char **order, int round) {
+    rng_state = UINT64_C(0x9e3779b97f4a7c15) * (round + 1);
+    memcpy(order, c->keys, c->distinct * sizeof order[0]);
+    shuffle(order, c->distinct);
+}
+
+/*
+ * Time one run of a hash table.
+ * @param s the structure under test
+ * @param c the corpus
+ * @param capacity the capacity of the table
+ * @param hashfn the hash function of the table
+ * @param r the timings, this run's are set
+ * @param rep the number of this run
+ * @return the number of queries found, after churn if there was any
+ */
+static int run_table(const struct structure *s, struct corpus *c,
+                     int capacity, hashfn_t hashfn, struct result *r,
+                     int rep) {
+    double start = seconds();
+    htable h = htable_new(capacity, s->method, hashfn);
+    char **order;
+    int i, round, found = 0;
+
+    for (i = 0; i < c->num_stream; i++) {
+        htable_insert(h, c->stream[i]);
+    }
+    r->fill[rep] = seconds() - start;
+    r->bytes = htable_memory(h);
+
+    start = seconds();
+    for (i = 0; i < c->num_queries; i++) {
+        found += htable_search(h, c->queries[i]) > 0;
+    }
+    r->search[rep] = seconds() - start;
+
+    if (r->rounds > 0) {
+        order = emalloc((c->distinct + 1) * sizeof order[0]);
+        r->churn[rep] = 0.0;
+        for (round = 0; round < r->rounds; round++) {
+            churn_keys(c, order, round);
+            start = seconds();
+            for (i = 0; i < c->distinct / 2; i++) {
+                htable_delete(h, order[i]);
+            }
+            for (i = 0; i < c->distinct / 2; i++) {
+                htable_insert(h, order[i]);
+            }
+            r->churn[rep] += seconds() - start;
+        }
+        free(order);
+
+        found = 0;
+        start = seconds();
+        for (i = 0; i < c->num_queries; i++) {
+            found += htable_search(h, c->queries[i]) > 0;
+        }
+        r->churned[rep] = seconds() - start;
+    }
+
+    htable_free(h);
+
+    return found;
+}
+
+/*
+ * Time one run of a tree. A frozen tree can't change, so is never
+ * churned.
+ * @param s the structure under test
+ * @param c the corpus
+ * @param r the timings, this run's are set
+ * @param rep the number of this run
+ * @return the number of queries found, after churn if there was any
+ */
+static int run_tree(const struct structure *s, struct corpus *c,
+                    struct result *r, int rep) {
+    double start = seconds();
+    tree t = tree_new(s->type);
+    frozen_tree f = NULL;
+    char **order;
+    int i, round, found = 0;
+
+    for (i = 0; i < c->num_stream; i++) {
+        t = tree_insert(t, c->stream[i]);
+        t = setColourBlack(t);
+    }
+    if (s->frozen) {
+        f = tree_freeze(t);
+    }
+    r->fill[rep] = seconds() - start;
+    r->bytes = f != NULL ? tree_frozen_memory(f) : tree_memory(t);
+
+    start = seconds();
+    for (i = 0; i < c->num_queries; i++) {
+        found += f != NULL ? tree_frozen_search(f, c->queries[i])
+            : tree_search(t, c->queries[i]);
+    }
+    r->search[rep] = seconds() - start;
+
+    if (r->rounds > 0 && f == NULL) {
+        order = emalloc((c->distinct + 1) * sizeof order[0]);
+        r->churn[rep] = 0.0;
+        for (round = 0; round < r->rounds; round++) {
+            churn_keys(c, order, round);
+            start = seconds();
+            for (i = 0; i < c->distinct / 2; i++) {
+                t = tree_delete(t, order[i]);
+            }
+            for (i = 0; i < c->distinct / 2; i++) {
+                t = tree_insert(t, order[i]);
+                t = setColourBlack(t);
+            }
+            r->churn[rep] += seconds() - start;
+        }
+        free(order);
+
+        found = 0;
+        start = seconds();
+        for (i = 0; i < c->num_queries; i++) {
+            found += tree_search(t, c->queries[i]);
+        }
+        r->churned[rep] = seconds() - start;
+    }
+
+    if (f != NULL) {
+        tree_frozen_free(f);
+    }
+    tree_free(t);
+
+    return found;
+}
+
+/*
+ * Time one run of an adaptive radix trie. The trie has no deletion, so
+ * is never churned.
+ * @param c the corpus
+ * @param r the timings, this run's are set
+ * @param rep the number of this run
+ * @return the number of queries found
+ */
+static int run_trie(struct corpus *c, struct result *r, int rep) {
+    double start = seconds();
+    trie t = trie_new();
+    int i, found = 0;
+
+    for (i = 0; i < c->num_stream; i++) {
+        t = trie_insert(t, c->stream[i]);
+    }
+    r->fill[rep] = seconds() - start;
+    r->bytes = trie_memory(t);
+
+    start = seconds();
+    for (i = 0; i < c->num_queries; i++) {
+        found += trie_search(t, c->queries[i]) > 0;
+    }
+    r->search[rep] = seconds() - start;
+
+    trie_free(t);
+
+    return found;
+}
+
+/*
+ * Time one run of approximate counting in a memory budget. Counts can't
+ * be taken back out of a sketch, so it is never churned.
+ * @param c the corpus
+ * @param budget the bytes the counts may take
+ * @param r the timings, this run's are set
+ * @param rep the number of this run
+ * @return the number of queries found, which takes in every present one
+ *  and maybe some absent ones, or -1 if the budget is too small
+ */
+static int run_sketch(struct corpus *c, long budget, struct result *r,
+                      int rep) {
+    double start = seconds();
+    hitters t = hitters_new(budget, SKETCH_TOP_K);
+    int i, found = 0;
+
+    if (t == NULL) {
+        return -1;
+    }
+    for (i = 0; i < c->num_stream; i++) {
+        hitters_add(t, c->stream[i]);
+    }
+    r->fill[rep] = seconds() - start;
+    r->bytes = (size_t) hitters_size(t);
+
+    start = seconds();
+    for (i = 0; i < c->num_queries; i++) {
+        found += hitters_estimate(t, c->queries[i]) > 0;
+    }
+    r->search[rep] = seconds() - start;
+
+    hitters_free(t);
+
+    return found;
+}
+
+/*
+ * Compare two doubles, for qsort.
+ */
+static int compare_times(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Find the median of some timings.
+ * @param times the timings, which are sorted as a side effect
+ * @param n the number of timings
+ * @return the median
+ */
+static double median(double *times, int n) {
+    qsort(times, n, sizeof times[0], compare_times);
+
+    return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+}
+
+/*
+ * Print the timings of one combination.
+ * @param json whether to print JSON rather than CSV
+ * @param first whether this is the first result printed
+ * @param tag the label given with -t, or NULL
+ * @param workload the name of the workload
+ * @param s the structure measured
+ * @param hash the name of the hash function, for tables
+ * @param c the corpus
+ * @param load the load factor, for tables
+ * @param capacity the capacity, for tables
+ * @param r the timings, which are sorted as a side effect
+ */
+static void print_result(int json, int first, char *tag,
+                         const char *workload, const struct structure *s,
+                         char *hash, struct corpus *c, double load,
+                         int capacity, struct result *r) {
+    double fill_med = median(r->fill, r->reps);
+    double search_med = median(r->search, r->reps);
+    double fill_min = r->fill[0], search_min = r->search[0];
+    double churned_med = 0.0, churn_min = 0.0, churned_min = 0.0;
+    int churned = r->rounds > 0 && !s->frozen && !s->approx && !s->radix;
+    long churn_ops = 2L * r->rounds * (c->distinct / 2);
+
+    if (churned) {
+        churned_med = median(r->churned, r->reps);
+        churned_min = r->churned[0];
+        median(r->churn, r->reps);
+        churn_min = r->churn[0];
+    }
+
+    if (json) {
+        printf("%s  {\"tag\": \"%s\", \"workload\": \"%s\", "
+               "\"structure\": \"%s\", ", first ? "" : ",\n",
+               tag != NULL ? tag : "", workload, s->name);
+        if (s->is_table) {
+            printf("\"hash\": \"%s\", \"load\": %.3f, \"capacity\": %d, ",
+                   hash, load, capacity);
+        } else {
+            printf("\"hash\": null, \"load\": null, \"capacity\": null, ");
+        }
+        printf("\"keys\": %d, \"tokens\": %d, \"queries\": %d, "
+               "\"reps\": %d, \"fill_min\": %.9f, \"fill_median\": %.9f, "
+               "\"search_min\": %.9f, \"search_median\": %.9f, "
+               "\"fill_mops\": %.3f, \"search_mops\": %.3f, ",
+               c->distinct, c->num_stream, c->num_queries, r->reps,
+               fill_min, fill_med, search_min, search_med,
+               c->num_stream / fill_min / 1e6,
+               c->num_queries / search_min / 1e6);
+        if (churned) {
+            printf("\"churn_rounds\": %d, \"churn_mops\": %.3f, "
+                   "\"churned_search_min\": %.9f, "
+                   "\"churned_search_median\": %.9f, "
+                   "\"churned_search_mops\": %.3f, ", r->rounds,
+                   churn_ops / churn_min / 1e6, churned_min, churned_med,
+                   c->num_queries / churned_min / 1e6);
+        } else {
+            printf("\"churn_rounds\": 0, \"churn_mops\": null, "
+                   "\"churned_search_min\": null, "
+                   "\"churned_search_median\": null, "
+                   "\"churned_search_mops\": null, ");
+        }
+        printf("\"bytes\": %lu}", (unsigned long) r->bytes);
+    } else {
+        printf("%s,%s,%s,", tag != NULL ? tag : "", workload, s->name);
+        if (s->is_table) {
+            printf("%s,%.3f,%d,", hash, load, capacity);
+        } else {
+            printf(",,,");
+        }
+        printf("%d,%d,%d,%d,%.9f,%.9f,%.9f,%.9f,%.3f,%.3f,",
+               c->distinct, c->num_stream, c->num_queries, r->reps,
+               fill_min, fill_med, search_min, search_med,
+               c->num_stream / fill_min / 1e6,
+               c->num_queries / search_min / 1e6);
+        if (churned) {
+            printf("%d,%.3f,%.9f,%.9f,%.3f,", r->rounds,
+                   churn_ops / churn_min / 1e6, churned_min, churned_med,
+                   c->num_queries / churned_min / 1e6);
+        } else {
+            printf("0,,,,,");
+        }
+        printf("%lu\n", (unsigned long) r->bytes);
+    }
+}
+
+/*
+ * Split a comma separated option into its entries.
+ * @param arg the option, which is modified
+ * @param items set to the entries
+ * @return the number of entries
+ */
+static int split_list(char *arg, char **items) {
+    char *item = strtok(arg, ",");
+    int n = 0;
+
+    while (item != NULL && n < LIST_MAX) {
+        items[n++] = item;
+        item = strtok(NULL, ",");
+    }
+
+    return n;
+}
+
+/*
+ * Print how to use the benchmark.
+ */
+static void print_usage(char *name) {
+    fprintf(stderr, "Usage: %s [-w workloads] [-d structures] [-n keys] "
+            "[-l loads]\n          [-r reps] [-s seed] [-z exponent] "
+            "[-H hash] [-i file] [-f csv|json] [-t tag]\n"
+            "          [-C rounds] [-B budget]\n", name);
+}
+
+int main(int argc, char **argv) {
+    const char *optstring = "w:d:n:l:r:s:z:H:i:f:t:C:B:h";
+    char default_workloads[] = "uniform,zipf,sorted,adversarial";
+    char default_structures[] = "lp,dh,rh,bst,rbt,frozen,art";
+    char default_keys[] = "1000,10000,100000";
+    char default_loads[] = "0.5,0.75,0.9";
+    char *workload_args = NULL, *structure_args = NULL;
+    char *key_args = NULL, *load_args = NULL;
+    char *items[LIST_MAX], *hash_name = "poly31", *path = NULL, *tag = NULL;
+    int num_workloads, num_structures, num_keys, num_loads;
+    workload_t workloads[LIST_MAX + 1];
+    int chosen[LIST_MAX], keys[LIST_MAX];
+    double loads[LIST_MAX], zipf_s = 1.0;
+    uint64_t seed = 42;
+    hashfn_t hashfn = POLY31;
+    struct corpus *c;
+    struct result r;
+    long budget = SKETCH_BUDGET;
+    int reps = 5, rounds = 0, json = 0, first = 1;
+    int i, j, k, l, rep, capacity, found;
+    int option;
+
+    while ((option = getopt(argc, argv, optstring)) != -1) {
+        switch (option) {
+            case 'w':
+                workload_args = optarg;
+                break;
+            case 'd':
+                structure_args = optarg;
+                break;
+            case 'n':
+                key_args = optarg;
+                break;
+            case 'l':
+                load_args = optarg;
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                zipf_s = atof(optarg);
+                break;
+            case 'H':
+                hash_name = optarg;
+                if (!htable_parse_hashfn(optarg, &hashfn)) {
+                    fprintf(stderr, "Unknown hash function: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                path = optarg;
+                break;
+            case 'f':
+                json = strcmp(optarg, "json") == 0;
+                break;
+            case 't':
+                tag = optarg;
+                break;
+            case 'C':
+                rounds = atoi(optarg);
+                break;
+            case 'B':
+                budget = atol(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    num_workloads = split_list(workload_args != NULL ? workload_args
+                               : default_workloads, items);
+    for (i = 0; i < num_workloads; i++) {
+        for (k = 0; k < FILE_WORDS; k++) {
+            if (strcmp(items[i], workload_names[k]) == 0) {
+                workloads[i] = (workload_t) k;
+                break;
+            }
+        }
+        if (k == FILE_WORDS) {
+            fprintf(stderr, "Unknown workload: %s\n", items[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (path != NULL) {
+        workloads[num_workloads++] = FILE_WORDS;
+    }
+
+    num_structures = split_list(structure_args != NULL ? structure_args
+                                : default_structures, items);
+    for (i = 0; i < num_structures; i++) {
+        for (k = 0; k < NUM_STRUCTURES; k++) {
+            if (strcmp(items[i], structures[k].name) == 0) {
+                chosen[i] = k;
+                break;
+            }
+        }
+        if (k == NUM_STRUCTURES) {
+            fprintf(stderr, "Unknown structure: %s\n", items[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    num_keys = split_list(key_args != NULL ? key_args : default_keys, items);
+    for (i = 0; i < num_keys; i++) {
+        keys[i] = atoi(items[i]);
+        if (keys[i] < 1) {
+            fprintf(stderr, "Bad number of keys: %s\n", items[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    num_loads = split_list(load_args != NULL ? load_args : default_loads,
+                           items);
+    for (i = 0; i < num_loads; i++) {
+        loads[i] = atof(items[i]);
+        if (loads[i] <= 0.0 || loads[i] >= 1.0) {
+            fprintf(stderr, "Bad load factor: %s\n", items[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (reps < 1) {
+        reps = 1;
+    }
+    r.reps = reps;
+    r.rounds = rounds > 0 ? rounds : 0;
+    r.fill = emalloc(reps * sizeof r.fill[0]);
+    r.search = emalloc(reps * sizeof r.search[0]);
+    r.churn = emalloc(reps * sizeof r.churn[0]);
+    r.churned = emalloc(reps * sizeof r.churned[0]);
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("tag,workload,structure,hash,load,capacity,keys,tokens,"
+               "queries,reps,fill_min,fill_median,search_min,"
+               "search_median,fill_mops,search_mops,churn_rounds,churn_mops,"
+               "churned_search_min,churned_search_median,"
+               "churned_search_mops,bytes\n");
+    }
+
+    for (i = 0; i < num_workloads; i++) {
+        for (j = 0; j < (workloads[i] == FILE_WORDS ? 1 : num_keys); j++) {
+            for (l = 0; l < num_loads; l++) {
+                if (workloads[i] == FILE_WORDS) {
+                    c = load_corpus(path, seed);
+                    if (c == NULL) {
+                        fprintf(stderr, "Failed to open file: %s\n", path);
+                        return EXIT_FAILURE;
+                    }
+                    capacity = next_highest_prime((int) (c->distinct
+                                                         / loads[l]));
+                } else {
+                    capacity = next_highest_prime((int) (keys[j] / loads[l]));
+                    c = make_corpus(workloads[i], keys[j], capacity, zipf_s,
+                                    seed);
+                }
+
+                for (k = 0; k < num_structures; k++) {
+                    const struct structure *s = &structures[chosen[k]];
+
+                    /* only tables use the load factor, run the rest once */
+                    if (!s->is_table && l > 0) {
+                        continue;
+                    }
+                    if (s->type == BST && !s->is_table && !s->approx
+                            && !s->radix && workloads[i] == SORTED
+                            && c->distinct > BST_SORTED_MAX) {
+                        fprintf(stderr, "Skipping bst on %d sorted keys, it "
+                                "is quadratic\n", c->distinct);
+                        continue;
+                    }
+
+                    for (rep = 0; rep < reps; rep++) {
+                        found = s->is_table
+                            ? run_table(s, c, capacity, hashfn, &r, rep)
+                            : s->approx ? run_sketch(c, budget, &r, rep)
+                            : s->radix ? run_trie(c, &r, rep)
+                            : run_tree(s, c, &r, rep);
+                        if (found < 0) {
+                            fprintf(stderr, "Budget of %ld bytes is too "
+                                    "small for %s\n", budget, s->name);
+                            return EXIT_FAILURE;
+                        }
+                        if (s->approx ? found < c->num_hits
+                                : found != c->num_hits) {
+                            fprintf(stderr, "%s on %s found %d of %d "
+                                    "queries\n", s->name,
+                                    workload_names[workloads[i]], found,
+                                    c->num_hits);
+                        }
+                    }
+                    print_result(json, first, tag,
+                                 workload_names[workloads[i]], s, hash_name,
+                                 c, loads[l], capacity, &r);
+                    first = 0;
+                    fflush(stdout);
+                }
+                free_corpus(c);
+            }
+        }
+    }
+
+    if (json) {
+        printf("\n]\n");
+    }
+
+    free(r.fill);
+    free(r.search);
+    free(r.churn);
+    free(r.churned);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+#include "mylib.h"
+
+/* Bits in one block, a 64 byte cache line */
+#define BLOOM_BLOCK_BITS 512
+
+/* Words of a block */
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BITS / 64)
+
+/* Most bits set per key */
+#define BLOOM_MAX_K 16
+
+/* Multipliers for the filter's string hash */
+#define BLOOM_K1 UINT64_C(0x9e3779b97f4a7c15)
+#define BLOOM_K2 UINT64_C(0xc2b2ae3d27d4eb4f)
+
+/* Generate bloom struct */
+struct bloomrec {
+    uint64_t *blocks;
+    void *mem;
+    long num_blocks;
+    int k;
+    long checks;
+    long rejects;
+};
+
+/* 
+ * Hash a string eight bytes at a time into 64 bits. The filter keeps its
+ * own hash so that its false positives don't line up with the collisions
+ * of whatever structure it screens.
+ * @param str the string to hash
+ * @return the 64-bit hash
+ */
+static uint64_t bloom_hash(char *str) {
+    size_t len = strlen(str);
+    uint64_t out = BLOOM_K2 ^ len, w;
+
+    for (; len >= 8; str += 8, len -= 8) {
+        memcpy(&w, str, 8);
+        out = (out ^ w) * BLOOM_K1;
+        out ^= out >> 31;
+    }
+
+    w = 0;
+    memcpy(&w, str, len);
+    out = (out ^ w) * BLOOM_K1;
+    out ^= out >> 29;
+    out *= BLOOM_K2;
+    out ^= out >> 32;
+
+    return out;
+}
+
+/* 
+ * Find the block a hash selects. The top half of the hash is scaled
+ * into the block count, leaving the bottom half to choose bits.
+ * @param b the filter
+ * @param hash the hash of a key
+ * @return the first word of the block
+ */
+static uint64_t *bloom_block(bloom b, uint64_t hash) {
+    uint64_t index = ((hash >> 32) * (uint64_t) b->num_blocks) >> 32;
+
+    return b->blocks + index * BLOOM_BLOCK_WORDS;
+}
+
+/* 
+ * Create a blocked Bloom filter. Every key sets k bits in a single
+ * cache line, so a check costs one cache miss at most, in exchange for
+ * a slightly higher false positive rate than a classic filter of the
+ * same size.
+ * @param expected the number of distinct keys the filter will hold
+ * @param fp_rate the false positive rate wanted, between 0 and 1
+ * @return the new, empty filter
+ */
+bloom bloom_new(int expected, double fp_rate) {
+    bloom b = emalloc(sizeof *b);
+    double bits_per_key;
+    size_t bytes;
+
+    if (fp_rate <= 0.0 || fp_rate >= 1.0) {
+        fp_rate = 0.01;
+    }
+    if (expected < 1) {
+        expected = 1;
+    }
+
+    bits_per_key = -log(fp_rate) / (log(2.0) * log(2.0));
+    b->k = (int) (bits_per_key * log(2.0) + 0.5);
+    b->k = b->k < 1 ? 1 : b->k > BLOOM_MAX_K ? BLOOM_MAX_K : b->k;
+    b->num_blocks = (long) (expected * bits_per_key / BLOOM_BLOCK_BITS) + 1;
+    b->checks = 0;
+    b->rejects = 0;
+
+    bytes = b->num_blocks * (BLOOM_BLOCK_BITS / 8);
+    b->mem = emalloc(bytes + BLOOM_BLOCK_BITS / 8);
+    b->blocks = (uint64_t *) (((uintptr_t) b->mem + BLOOM_BLOCK_BITS / 8 - 1)
+                              & ~(uintptr_t) (BLOOM_BLOCK_BITS / 8 - 1));
+    memset(b->blocks, 0, bytes);
+
+    return b;
+}
+
+/* 
+ * Add a key to a filter.
+ * @param b the filter
+ * @param str the key to add
+ */
+void bloom_add(bloom b, char *str) {
+    uint64_t hash = bloom_hash(str);
+    uint64_t *block = bloom_block(b, hash);
+    unsigned int bit = (unsigned int) hash;
+    unsigned int step = (unsigned int) (hash * BLOOM_K1 >> 32) | 1;
+    int i;
+
+    for (i = 0; i < b->k; i++, bit += step) {
+        block[(bit % BLOOM_BLOCK_BITS) / 64] |= UINT64_C(1) << (bit % 64);
+    }
+}
+
+/* 
+ * Check whether a key may be in a filter.
+ * @param b the filter
+ * @param str the key to look for
+ * @return 0 if the key was definitely never added, 1 if it may have been
+ */
+int bloom_check(bloom b, char *str) {
+    uint64_t hash = bloom_hash(str);
+    uint64_t *block = bloom_block(b, hash);
+    unsigned int bit = (unsigned int) hash;
+    unsigned int step = (unsigned int) (hash * BLOOM_K1 >> 32) | 1;
+    int i;
+
+    b->checks++;
+    for (i = 0; i < b->k; i++, bit += step) {
+        if ((block[(bit % BLOOM_BLOCK_BITS) / 64]
+                & UINT64_C(1) << (bit % 64)) == 0) {
+            b->rejects++;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* 
+ * Report how many checks a filter has answered.
+ * @param b the filter
+ * @param checks set to the number of calls to bloom_check
+ * @param rejects set to how many of them ruled the key out
+ */
+void bloom_counts(bloom b, long *checks, long *rejects) {
+    *checks = b->checks;
+    *rejects = b->rejects;
+}
+
+/* 
+ * Size of a filter's bit array.
+ * @param b the filter
+ * @return the number of bytes of bits
+ */
+long bloom_size(bloom b) {
+    return b->num_blocks * (BLOOM_BLOCK_BITS / 8);
+}
+
+/* 
+ * Free a filter.
+ * @param b the filter to free
+ */
+void bloom_free(bloom b) {
+    free(b->mem);
+    free(b);
+}
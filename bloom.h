@@ -0,0 +1,14 @@
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+/* Header file for blocked Bloom filter implementation */
+typedef struct bloomrec *bloom;
+
+extern void bloom_add(bloom b, char *str);
+extern int bloom_check(bloom b, char *str);
+extern void bloom_counts(bloom b, long *checks, long *rejects);
+extern void bloom_free(bloom b);
+extern bloom bloom_new(int expected, double fp_rate);
+extern long bloom_size(bloom b);
+
+#endif
@@ -1,24 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "htable.h"
 #include "mylib.h"
 
+/* Number of old slots migrated by each insert while a rehash is underway */
+#define HTABLE_MIGRATE_STEP 8
+
+/* Number of lookups htable_search_batch keeps in flight at once */
+#define HTABLE_BATCH 16
+
+/* The frequency of a slot whose key was deleted from a double hashing
+   table. Its key is NULL like an empty slot's, but probes go past it */
+#define HTABLE_TOMBSTONE -1
+
+/* A double hashing table is rebuilt once this fraction of its slots
+   are tombstones */
+#define HTABLE_TOMBSTONE_LIMIT 4
+
+/* Buckets of keys smaller than this are finished by insertion sort */
+#define HTABLE_RADIX_CUTOFF 32
+
+/* Bytes of the key field of a slot. Keys shorter than this are kept in
+   the slot itself, longer ones in the table's arena */
+#define HTABLE_INLINE_SIZE 16
+#define HTABLE_INLINE_MAX (HTABLE_INLINE_SIZE - 1)
+
+/* Last byte of the key field of a slot holding a long key, or none */
+#define HTABLE_KEY_LONG 0x80
+#define HTABLE_KEY_EMPTY 0xff
+
+/* The last byte of a key field, which says what the field holds */
+#define HTABLE_KEY_TAG(k) ((unsigned char) (k).bytes[HTABLE_INLINE_SIZE - 1])
+
+/* Hint that a cache line will be read soon */
+#ifdef __GNUC__
+#define HTABLE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HTABLE_PREFETCH(p) ((void) 0)
+#endif
+
+/* Run a counter update only in builds made with -DINSTRUMENT, so the
+   counters cost nothing otherwise */
+#ifdef INSTRUMENT
+#define HTABLE_COUNT(stmt) (stmt)
+#else
+#define HTABLE_COUNT(stmt) ((void) 0)
+#endif
+
+/* Multipliers for the word-at-a-time hash */
+#define MIX_K1 UINT64_C(0x9e3779b97f4a7c15)
+#define MIX_K2 UINT64_C(0xff51afd7ed558ccd)
+
+/* One SipHash round over the state v0..v3 */
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0, v1, v2, v3) do { \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while (0)
+
+/* Identifies hash table snapshot files, and the layout they use */
+#define HTABLE_MAGIC "HTABSNAP"
+#define HTABLE_VERSION 1
+
+/* Written in native byte order, to spot files from other machines */
+#define HTABLE_BYTE_ORDER 0x01020304u
+
+/* Names of the hash functions, indexed by hashfn_t */
+static const char *hashfn_names[] = {
+    "31 * h + c", "FNV-1a", "word multiply-mix", "SipHash-1-3"
+};
+
+/* 
+ * The key of a slot. A key of up to HTABLE_INLINE_MAX bytes is held in
+ * bytes, padded with nuls, with the number of bytes it falls short of
+ * HTABLE_INLINE_MAX in the last byte, which is then also the nul of a
+ * key of the full length. Otherwise the last byte is HTABLE_KEY_LONG and
+ * ptr points to the key in the table's arena, or HTABLE_KEY_EMPTY and
+ * ptr is NULL.
+ */
+union htable_key {
+    char *ptr;
+    char bytes[HTABLE_INLINE_SIZE];
+    uint64_t words[HTABLE_INLINE_SIZE / 8];
+};
+
+/* 
+ * A table slot keeps the full hash and frequency next to the key, so a
+ * probe can reject a mismatch without touching the key, and short keys
+ * are compared without leaving the slot.
+ */
+struct htable_slot {
+    unsigned int hash;
+    int frequency;
+    union htable_key key;
+};
+
+/* An occupied slot copied out for sorting */
+struct htable_entry {
+    char *key;
+    int frequency;
+};
+
+/* The head of a snapshot file. Offsets count from the start of the file */
+struct htable_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t method;
+    uint32_t hashfn;
+    uint32_t capacity;
+    uint32_t num_keys;
+    uint64_t sip_key[2];
+    uint64_t slots_offset;
+    uint64_t keys_offset;
+    uint64_t keys_size;
+};
+
+/* A slot of a snapshot. Keys are offsets into the snapshot's key block,
+   which starts with an empty string so that offset 0 marks a free slot */
+struct htable_disk_slot {
+    uint32_t hash;
+    int32_t frequency;
+    uint32_t key;
+};
+
 /* Generate hash table struct */
 struct htablerec {
-    char **keys;
-    int *frequencies;
+    struct htable_slot *slots;
     int num_keys;
     int capacity;
     int *stats;
     hashing_t method;
+    hashfn_t hashfn;
+    uint64_t sip_key[2];
+    double max_load;
+    struct htable_slot *old_slots;
+    int old_capacity;
+    int migrate_pos;
+    int resizes;
+    int concurrent;
+    int tombstones;
+    arena key_store;
+    size_t live_bytes;
+    size_t dead_bytes;
+    void *map;
+    size_t map_size;
+    struct htable_disk_slot *disk_slots;
+    char *disk_keys;
+    size_t disk_keys_size;
+#ifdef INSTRUMENT
+    struct htable_counters counters;
+#endif
 };
 
+#ifdef INSTRUMENT
+/* 
+ * Count the outcome of a search and the length of its probe.
+ * @param h a given hash table
+ * @param found whether the key was found
+ * @param probes the slots looked at beyond the home slot
+ */
+static void htable_count_search(htable h, int found, int probes) {
+    if (probes >= HTABLE_PROBE_BUCKETS) {
+        probes = HTABLE_PROBE_BUCKETS - 1;
+    }
+    if (found) {
+        h->counters.hits++;
+        h->counters.hit_probes[probes]++;
+    } else {
+        h->counters.misses++;
+        h->counters.miss_probes[probes]++;
+    }
+}
+#endif
+
 /* 
- * 
+ * Calculate the probing step for a key's home index. Double hashing
+ * derives the step from the home index, linear probing always uses 1.
+ * @param h a given hash table
+ * @param capacity the capacity of the table being probed
+ * @param i_key the home index of the key
+ * @return the step between successive probes
  */
-static unsigned int htable_step(htable h, unsigned int i_key) {
-    return 1 + (i_key % (h->capacity - 1));
+static unsigned int htable_step(htable h, int capacity, unsigned int i_key) {
+    if (h->method == DOUBLE_H) {
+        return 1 + (i_key % (capacity - 1));
+    }
+    return 1;
 }
 
 /* 
@@ -37,112 +213,889 @@ static unsigned int str_to_int(char *str) {
     return out;
 }
 
+/* 
+ * FNV-1a hash of a string, one byte at a time.
+ * @param str a value to be converted
+ * @return the 32-bit hash
+ */
+static unsigned int fnv1a(char *str) {
+    unsigned int out = 2166136261u;
+
+    while (*str != '\0') {
+        out ^= (unsigned char) *str++;
+        out *= 16777619u;
+    }
+
+    return out;
+}
+
+/* 
+ * Hash a string eight bytes at a time, mixing each word in with a
+ * multiply and shift and finishing with a final avalanche.
+ * @param str a value to be converted
+ * @return the 32-bit hash
+ */
+static unsigned int word_mix(char *str) {
+    size_t len = strlen(str);
+    uint64_t out = MIX_K1 ^ len, w;
+
+    for (; len >= 8; str += 8, len -= 8) {
+        memcpy(&w, str, 8);
+        out = (out ^ w) * MIX_K1;
+        out ^= out >> 29;
+    }
+
+    w = 0;
+    memcpy(&w, str, len);
+    out = (out ^ w) * MIX_K1;
+    out ^= out >> 32;
+    out *= MIX_K2;
+    out ^= out >> 29;
+
+    return (unsigned int) (out ^ (out >> 32));
+}
+
+/* 
+ * Keyed SipHash-1-3 of a string, folded to 32 bits. Without the key an
+ * attacker can't build inputs that all land in the same slots.
+ * @param key the 128-bit key
+ * @param str a value to be converted
+ * @return the 32-bit hash
+ */
+static unsigned int siphash(const uint64_t key[2], char *str) {
+    size_t len = strlen(str);
+    uint64_t v0 = key[0] ^ UINT64_C(0x736f6d6570736575);
+    uint64_t v1 = key[1] ^ UINT64_C(0x646f72616e646f6d);
+    uint64_t v2 = key[0] ^ UINT64_C(0x6c7967656e657261);
+    uint64_t v3 = key[1] ^ UINT64_C(0x7465646279746573);
+    uint64_t m, b = (uint64_t) len << 56;
+
+    for (; len >= 8; str += 8, len -= 8) {
+        memcpy(&m, str, 8);
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    m = 0;
+    memcpy(&m, str, len);
+    b |= m;
+
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+
+    m = v0 ^ v1 ^ v2 ^ v3;
+    return (unsigned int) (m ^ (m >> 32));
+}
+
+/* 
+ * Hash a string with the hash function a table was created with.
+ * @param h a given hash table
+ * @param str a value to be converted
+ * @return the 32-bit hash
+ */
+static unsigned int htable_hash(htable h, char *str) {
+    switch (h->hashfn) {
+        case FNV1A:
+            return fnv1a(str);
+        case WORD_MIX:
+            return word_mix(str);
+        case SIPHASH:
+            return siphash(h->sip_key, str);
+        default:
+            return str_to_int(str);
+    }
+}
+
+/* 
+ * Look up a hash function by its short name: poly31, fnv1a, wordmix or
+ * siphash.
+ * @param name the name of the hash function
+ * @param hashfn set to the matching hash function
+ * @return 1 if the name was recognised, 0 otherwise
+ */
+int htable_parse_hashfn(char *name, hashfn_t *hashfn) {
+    static const char *names[] = {"poly31", "fnv1a", "wordmix", "siphash"};
+    static const hashfn_t fns[] = {POLY31, FNV1A, WORD_MIX, SIPHASH};
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *hashfn = fns[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 
+ * Pick a random SipHash key for a table, falling back to the clock and
+ * the table's address when /dev/urandom can't be read.
+ * @param h a given hash table
+ */
+static void htable_seed(htable h) {
+    FILE *random = fopen("/dev/urandom", "rb");
+
+    if (random == NULL
+            || fread(h->sip_key, sizeof h->sip_key, 1, random) != 1) {
+        h->sip_key[0] = (uint64_t) time(NULL) ^ (uint64_t) (size_t) h;
+        h->sip_key[1] = (uint64_t) clock() * MIX_K1;
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+}
+
+/* 
+ * Calculate how far a slot is from the home index of the key it holds.
+ * @param hash the full hash of the key
+ * @param index the slot the key occupies
+ * @param capacity the capacity of the slot array
+ * @return the number of slots between home and index
+ */
+static int htable_distance(unsigned int hash, unsigned int index,
+                           int capacity) {
+    return (index + capacity - hash % capacity) % capacity;
+}
+
+/* 
+ * Mark a key field as holding no key.
+ * @param k the key field
+ */
+static void htable_clear_key(union htable_key *k) {
+    memset(k, 0, sizeof *k);
+    k->bytes[HTABLE_INLINE_SIZE - 1] = (char) HTABLE_KEY_EMPTY;
+}
+
+/* 
+ * Fill in a key field for a string, the way a slot would hold it, so
+ * probes can compare it with the key fields of the slots. A long string
+ * is pointed to, not copied.
+ * @param k the key field
+ * @param str the string
+ * @return the length of the string
+ */
+static size_t htable_make_key(union htable_key *k, char *str) {
+    size_t len = strlen(str);
+
+    memset(k, 0, sizeof *k);
+    if (len <= HTABLE_INLINE_MAX) {
+        memcpy(k->bytes, str, len);
+        k->bytes[HTABLE_INLINE_SIZE - 1] = (char) (HTABLE_INLINE_MAX - len);
+    } else {
+        k->ptr = str;
+        k->bytes[HTABLE_INLINE_SIZE - 1] = (char) HTABLE_KEY_LONG;
+    }
+
+    return len;
+}
+
+/* 
+ * Compare the key field of a slot with one made by htable_make_key.
+ * Short keys are compared a word at a time, lengths and all, long ones
+ * with strcmp. A concurrent table holds even short keys out of line, so
+ * a short probe is compared with strcmp against a long slot too.
+ * @param k the key field of a slot
+ * @param probe the key field to compare it with
+ * @return 1 if they hold the same key, 0 otherwise
+ */
+static int htable_key_equal(union htable_key *k, union htable_key *probe) {
+    if (HTABLE_KEY_TAG(*k) == HTABLE_KEY_LONG) {
+        return strcmp(k->ptr, HTABLE_KEY_TAG(*probe) == HTABLE_KEY_LONG
+                      ? probe->ptr : probe->bytes) == 0;
+    }
+    return HTABLE_KEY_TAG(*probe) != HTABLE_KEY_LONG
+        && k->words[0] == probe->words[0]
+        && k->words[1] == probe->words[1];
+}
+
+/* 
+ * The key held by a slot, which stays valid until the table changes.
+ * @param slot the slot
+ * @return the key, or NULL if the slot is free
+ */
+static char *htable_slot_key(struct htable_slot *slot) {
+    switch (HTABLE_KEY_TAG(slot->key)) {
+        case HTABLE_KEY_EMPTY:
+            return NULL;
+        case HTABLE_KEY_LONG:
+            return slot->key.ptr;
+        default:
+            return slot->key.bytes;
+    }
+}
+
+/* 
+ * Look for a key along its probe sequence. Keys are only compared when
+ * the stored hash matches. With Robin Hood hashing the search stops at
+ * the first slot whose key sits closer to home than the key being looked
+ * for, since an insert would have displaced that key. Tombstones left
+ * by deletes are probed past, and the first one seen is where an absent
+ * key goes.
+ * @param h a given hash table
+ * @param slots the slot array to probe
+ * @param capacity the capacity of the slot array
+ * @param key the key to look for, as made by htable_make_key
+ * @param hash the full hash of the key
+ * @param collisions set to the number of slots probed before stopping
+ * @param place set to the slot where an absent key belongs, or -1 if
+ *  the table has no room for it
+ * @return the index of the slot holding the key, or -1 if not present
+ */
+static int htable_probe(htable h, struct htable_slot *slots, int capacity,
+                        union htable_key *key, unsigned int hash,
+                        int *collisions, int *place) {
+    unsigned int index = hash % capacity;
+    unsigned int step = htable_step(h, capacity, index);
+    int i;
+
+    *place = -1;
+
+    for (i = 0; i < capacity; i++) {
+        if (HTABLE_KEY_TAG(slots[index].key) == HTABLE_KEY_EMPTY) {
+            if (*place < 0) {
+                *place = index;
+            }
+            if (slots[index].frequency != HTABLE_TOMBSTONE) {
+                break;
+            }
+        } else if (h->method == ROBIN_HOOD
+                && htable_distance(slots[index].hash, index, capacity) < i) {
+            *place = index;
+            break;
+        } else if (slots[index].hash == hash) {
+            HTABLE_COUNT(h->counters.strcmps++);
+            if (htable_key_equal(&slots[index].key, key)) {
+                *collisions = i;
+                return index;
+            }
+        }
+
+        index = (index + step) % capacity;
+    }
+
+    *collisions = i;
+    return -1;
+}
+
+/* 
+ * Store an entry at the slot found for it by htable_probe. Under Robin
+ * Hood hashing the slot may be held by a key closer to its home, which
+ * is pushed further along, displacing keys in turn until one lands in
+ * an empty slot.
+ * @param h a given hash table
+ * @param slots the slot array to store into
+ * @param capacity the capacity of the slot array
+ * @param entry the entry to store
+ * @param index the slot found for the entry
+ */
+static void htable_place(htable h, struct htable_slot *slots, int capacity,
+                         struct htable_slot entry, int index) {
+    struct htable_slot displaced;
+    int dist;
+
+    if (h->method != ROBIN_HOOD) {
+        slots[index] = entry;
+        return;
+    }
+
+    dist = htable_distance(entry.hash, index, capacity);
+
+    while (HTABLE_KEY_TAG(slots[index].key) != HTABLE_KEY_EMPTY) {
+        if (htable_distance(slots[index].hash, index, capacity) < dist) {
+            displaced = slots[index];
+            slots[index] = entry;
+            entry = displaced;
+            dist = htable_distance(entry.hash, index, capacity);
+        }
+        index = (index + 1) % capacity;
+        dist++;
+    }
+
+    slots[index] = entry;
+}
+
+/* 
+ * Allocate the slot array for a table of a given capacity.
+ * @param h a given hash table
+ */
+static void htable_alloc_slots(htable h) {
+    int i;
+
+    h->slots = emalloc(h->capacity * sizeof h->slots[0]);
+
+    for (i = 0; i < h->capacity; i++) {
+        h->slots[i].hash = 0;
+        h->slots[i].frequency = 0;
+        htable_clear_key(&h->slots[i].key);
+    }
+}
+
 /* 
  * Generate a new hash table.
  * @param capacity the total capacity of the intended table
  * @param method the chosen hashing method the table uses
+ * @param hashfn the hash function the table uses for its keys
  * @return return  the hash table generated by the function
  */
-htable htable_new(int capacity, hashing_t method) {
+htable htable_new(int capacity, hashing_t method, hashfn_t hashfn) {
     int i;
 
     htable h = emalloc(sizeof *h);
 
     h->capacity = capacity;
     h->num_keys = 0;
+    h->method = method;
+    h->hashfn = hashfn;
+    h->max_load = 0.0;
+    h->old_slots = NULL;
+    h->old_capacity = 0;
+    h->migrate_pos = 0;
+    h->resizes = 0;
+    h->concurrent = 0;
+    h->tombstones = 0;
+    h->key_store = arena_new();
+    h->live_bytes = 0;
+    h->dead_bytes = 0;
+    h->map = NULL;
+    h->map_size = 0;
+    h->disk_slots = NULL;
+    h->disk_keys = NULL;
+    h->disk_keys_size = 0;
+    HTABLE_COUNT(memset(&h->counters, 0, sizeof h->counters));
 
-    h->frequencies = emalloc(h->capacity * sizeof h->frequencies[0]);
-    h->keys = emalloc(h->capacity * sizeof h->keys[0]);
-    h->stats = emalloc(h->capacity * sizeof h->stats[0]);
+    if (hashfn == SIPHASH) {
+        htable_seed(h);
+    }
 
-    h->method = method;
+    htable_alloc_slots(h);
+    h->stats = emalloc(h->capacity * sizeof h->stats[0]);
 
     for (i = 0; i < h->capacity; i++) {
-        h->frequencies[i] = 0;
-        h->keys[i] = NULL;
+        h->stats[i] = 0;
     }
 
     return h;
 }
 
 /* 
- * Free memory allocated to a given hash table.
+ * Generate a new hash table that several threads may insert into at
+ * once. Empty slots are claimed with a compare-and-swap on the key
+ * pointer and frequencies are bumped with atomic adds. The capacity is
+ * fixed, and since Robin Hood hashing moves keys that other threads may
+ * be probing past, it falls back to linear probing.
+ * @param capacity the total capacity of the intended table
+ * @param method the chosen hashing method the table uses
+ * @param hashfn the hash function the table uses for its keys
+ * @return the hash table generated by the function
+ */
+htable htable_new_concurrent(int capacity, hashing_t method,
+                             hashfn_t hashfn) {
+    htable h = htable_new(capacity, method == DOUBLE_H ? DOUBLE_H : LINEAR_P,
+                          hashfn);
+
+    h->concurrent = 1;
+
+    return h;
+}
+
+/* 
+ * Enable automatic growth of a hash table. Once a new key would take the
+ * table past max_load of its capacity the table switches to a larger
+ * capacity and migrates the old slots a few at a time on later inserts.
+ * @param h a given hash table
+ * @param max_load the load factor that triggers growth, 0 to keep the
+ *  capacity fixed. Concurrent tables never grow.
+ */
+void htable_set_max_load(htable h, double max_load) {
+    if (!h->concurrent) {
+        h->max_load = max_load;
+    }
+}
+
+/* 
+ * Bytes of memory a hash table takes: its slots and their probe stats,
+ * any old slots still being migrated, and the keys too long to be held
+ * in a slot, counting those deleted but not yet compacted away.
+ * @param h a given hash table
+ * @return the number of bytes
+ */
+size_t htable_memory(htable h) {
+    return h->capacity * (sizeof h->slots[0] + sizeof h->stats[0])
+        + h->old_capacity * sizeof h->slots[0]
+        + h->live_bytes + h->dead_bytes;
+}
+
+/* 
+ * Bytes each slot of a hash table takes along with its probe stats, for
+ * callers sizing a table to a memory budget.
+ * @return the number of bytes
+ */
+size_t htable_slot_size(void) {
+    struct htablerec h;
+
+    return sizeof h.slots[0] + sizeof h.stats[0];
+}
+
+/* 
+ * Move up to a given number of old slots into the current table, freeing
+ * the old arrays once every slot has been migrated. Old slots before
+ * migrate_pos are treated as moved and are never probed for a match.
+ * @param h a given hash table
+ * @param slots the maximum number of old slots to migrate
+ */
+static void htable_migrate(htable h, int slots) {
+    int i, collisions, place;
+
+    while (slots-- > 0 && h->migrate_pos < h->old_capacity) {
+        i = h->migrate_pos++;
+
+        if (HTABLE_KEY_TAG(h->old_slots[i].key) != HTABLE_KEY_EMPTY) {
+            htable_probe(h, h->slots, h->capacity, &h->old_slots[i].key,
+                         h->old_slots[i].hash, &collisions, &place);
+            htable_place(h, h->slots, h->capacity, h->old_slots[i], place);
+        }
+    }
+
+    if (h->migrate_pos == h->old_capacity) {
+        free(h->old_slots);
+        h->old_slots = NULL;
+        h->old_capacity = 0;
+        h->migrate_pos = 0;
+    }
+}
+
+/* 
+ * Complete any rehash that is still underway.
+ * @param h a given hash table
+ */
+static void htable_finish_rehash(htable h) {
+    if (h->old_slots != NULL) {
+        htable_migrate(h, h->old_capacity);
+    }
+}
+
+/* 
+ * Start moving a hash table to roughly twice its capacity. The new
+ * capacity is kept prime so double hashing still visits every slot.
+ * The collision history in stats is kept as recorded at insert time.
+ * @param h a given hash table
+ */
+static void htable_grow(htable h) {
+    int i, old_capacity;
+
+    htable_finish_rehash(h);
+
+    h->old_slots = h->slots;
+    h->old_capacity = old_capacity = h->capacity;
+    h->migrate_pos = 0;
+
+    h->capacity = next_highest_prime(2 * old_capacity);
+    htable_alloc_slots(h);
+    h->tombstones = 0;
+
+    h->stats = erealloc(h->stats, h->capacity * sizeof h->stats[0]);
+    for (i = old_capacity; i < h->capacity; i++) {
+        h->stats[i] = 0;
+    }
+
+    h->resizes++;
+}
+
+/* 
+ * Free memory allocated to a given hash table. Long keys live in the
+ * table's arena so they are released a chunk at a time, apart from those
+ * of a concurrent table which are allocated one by one.
  * @param h the hash table to be freed of allocated memory  
  */
 void htable_free(htable h) {
     int i;
 
-    for (i = 0; i < h->capacity; i++) {
-        free(h->keys[i]);
+    if (h->map != NULL) {
+        unmap_file(h->map, h->map_size);
+        free(h);
+        return;
+    }
+
+    if (h->concurrent) {
+        for (i = 0; i < h->capacity; i++) {
+            free(h->slots[i].key.ptr);
+        }
     }
+    arena_free(h->key_store);
 
-    free(h->keys);
-    free(h->frequencies);
+    free(h->slots);
+    free(h->old_slots);
+    free(h->stats);
 
     free(h);
 }
 
 /* 
- * Insert a value into a given hash table.
+ * Add a number of occurrences of a key to a concurrent hash table. A
+ * thread claims an empty slot by swapping its own copy of the key into
+ * the slot's key pointer, then publishes the hash. Until the hash is
+ * published other threads see 0 there and fall back to strcmp. Every
+ * key of a concurrent table is held out of line, since only a pointer
+ * can be swapped in at once, and is marked long once claimed.
+ * @param h a given concurrent hash table
+ * @param str the key to add
+ * @param hash the full hash of the key
+ * @param count the number of occurrences to add
+ * @return the key's new frequency, or 0 if the table is full
+ */
+static int htable_add_shared(htable h, char *str, unsigned int hash,
+                             int count) {
+    unsigned int index = hash % h->capacity;
+    unsigned int step = htable_step(h, h->capacity, index);
+    struct htable_slot *slot;
+    unsigned int slot_hash;
+    char *key, *copy = NULL;
+    int i;
+
+    for (i = 0; i < h->capacity; i++) {
+        slot = &h->slots[index];
+        key = __atomic_load_n(&slot->key.ptr, __ATOMIC_ACQUIRE);
+
+        if (key == NULL) {
+            if (copy == NULL) {
+                copy = emalloc((strlen(str) + 1) * sizeof(char));
+                strcpy(copy, str);
+            }
+            if (__atomic_compare_exchange_n(&slot->key.ptr, &key, copy, 0,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&slot->key.bytes[HTABLE_INLINE_SIZE - 1],
+                                 (char) HTABLE_KEY_LONG, __ATOMIC_RELAXED);
+                __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+                h->stats[__atomic_fetch_add(&h->num_keys, 1,
+                                            __ATOMIC_RELAXED)] = i;
+                return __atomic_add_fetch(&slot->frequency, count,
+                                          __ATOMIC_RELAXED);
+            }
+            /* Another thread claimed the slot first, key is now theirs */
+        }
+
+        slot_hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if ((slot_hash == hash || slot_hash == 0) && strcmp(key, str) == 0) {
+            free(copy);
+            return __atomic_add_fetch(&slot->frequency, count,
+                                      __ATOMIC_RELAXED);
+        }
+
+        index = (index + step) % h->capacity;
+    }
+
+    free(copy);
+    return 0;
+}
+
+/* 
+ * Add a number of occurrences of a key to a given hash table.
  * @param h a given hash table
- * @param str a value to insert 
- * @return an integer to indicate insertion outcome
+ * @param str the key to add
+ * @param hash the full hash of the key
+ * @param count the number of occurrences to add
+ * @return the key's new frequency, or 0 if the table is full or was
+ *  loaded from a snapshot
  */
-int htable_insert(htable h, char *str) {
-    unsigned int index = str_to_int(str) % h->capacity;
-    unsigned int index_origin;
-    unsigned int step;
-    int collisions = 0;
+static int htable_add(htable h, char *str, unsigned int hash, int count) {
+    struct htable_slot entry;
+    int index, place, collisions;
+    int freq;
+    size_t len;
 
-    if (h->method == DOUBLE_H) {
-        step = htable_step(h, index);
-    } else {
-        step = 1;
+    if (h->map != NULL) {
+        return 0;
+    }
+
+    if (h->concurrent) {
+        return htable_add_shared(h, str, hash, count);
+    }
+    HTABLE_COUNT(h->counters.inserts++);
+
+    len = htable_make_key(&entry.key, str);
+    index = htable_probe(h, h->slots, h->capacity, &entry.key, hash,
+                         &collisions, &place);
+
+    if (index >= 0) {
+        freq = h->slots[index].frequency += count;
+        htable_migrate(h, HTABLE_MIGRATE_STEP);
+        return freq;
     }
 
-    if (h->keys[index] == NULL) {
-        h->keys[index] = emalloc((strlen(str) + 1) * sizeof h->keys[0][0]);
-        strcpy(h->keys[index], str);
+    if (h->old_slots != NULL) {
+        int old_index, old_collisions, old_place;
 
-        h->frequencies[index] = 1;
-        h->stats[h->num_keys] = collisions;
-        h->num_keys++;
+        old_index = htable_probe(h, h->old_slots, h->old_capacity,
+                                 &entry.key, hash, &old_collisions,
+                                 &old_place);
 
-        return 1;
+        if (old_index >= h->migrate_pos) {
+            freq = h->old_slots[old_index].frequency += count;
+            htable_migrate(h, HTABLE_MIGRATE_STEP);
+            return freq;
+        }
     }
 
-    if (strcmp(h->keys[index], str) == 0) {
-        return ++h->frequencies[index];
+    /* only a new key can take the table past its load factor */
+    if (h->max_load > 0 && h->num_keys + 1 > h->capacity * h->max_load) {
+        htable_grow(h);
+        htable_probe(h, h->slots, h->capacity, &entry.key, hash,
+                     &collisions, &place);
     }
 
-    index_origin = index;
+    if (place < 0 || h->num_keys >= h->capacity) {
+        return 0;
+    }
 
-    do {
-        index += step;
-        index %= h->capacity;
-        collisions++;
+    if (len > HTABLE_INLINE_MAX) {
+        entry.key.ptr = arena_strdup(h->key_store, str);
+        h->live_bytes += len + 1;
+    }
+    entry.hash = hash;
+    entry.frequency = count;
 
-        if (h->keys[index] == NULL) {
-            h->keys[index] = emalloc((strlen(str) + 1) * sizeof h->keys[0][0]);
-            strcpy(h->keys[index], str);
+    if (h->slots[place].frequency == HTABLE_TOMBSTONE) {
+        h->tombstones--;
+    }
+    htable_place(h, h->slots, h->capacity, entry, place);
+    h->stats[h->num_keys] = collisions;
+    h->num_keys++;
 
-            h->frequencies[index] = 1;
-            h->stats[h->num_keys] = collisions;
-            h->num_keys++;
+    htable_migrate(h, HTABLE_MIGRATE_STEP);
 
-            return 1;
+    return count;
+}
+
+/* 
+ * Place every key of a table again in a fresh slot array of the same
+ * capacity, which clears out the tombstones of a double hashing table.
+ * @param h a given hash table, with no rehash underway
+ */
+static void htable_rebuild(htable h) {
+    struct htable_slot *old = h->slots;
+    int i, collisions, place;
+
+    htable_alloc_slots(h);
+    for (i = 0; i < h->capacity; i++) {
+        if (HTABLE_KEY_TAG(old[i].key) != HTABLE_KEY_EMPTY) {
+            htable_probe(h, h->slots, h->capacity, &old[i].key, old[i].hash,
+                         &collisions, &place);
+            htable_place(h, h->slots, h->capacity, old[i], place);
+        }
+    }
+    h->tombstones = 0;
+
+    free(old);
+}
+
+/* 
+ * Copy the long keys of a table into a new arena, leaving behind the
+ * bytes of deleted keys.
+ * @param h a given hash table, with no rehash underway
+ */
+static void htable_compact_keys(htable h) {
+    arena old = h->key_store;
+    int i;
+
+    h->key_store = arena_new();
+    for (i = 0; i < h->capacity; i++) {
+        if (HTABLE_KEY_TAG(h->slots[i].key) == HTABLE_KEY_LONG) {
+            h->slots[i].key.ptr = arena_strdup(h->key_store,
+                                               h->slots[i].key.ptr);
+        }
+    }
+    h->dead_bytes = 0;
+
+    arena_free(old);
+}
+
+/* 
+ * Empty the slot of a deleted key in a linear probing or Robin Hood
+ * table by moving later keys of the same run back into the hole, so
+ * that no probe sequence is broken and no tombstone is needed. A key
+ * stays put if moving it would take it back past its home slot, and
+ * under Robin Hood hashing the first such key ends the run.
+ * @param h a given hash table
+ * @param hole the slot of the deleted key
+ */
+static void htable_shift_back(htable h, unsigned int hole) {
+    struct htable_slot *slots = h->slots, empty;
+    unsigned int next = (hole + 1) % h->capacity, home;
+
+    empty.hash = 0;
+    empty.frequency = 0;
+    htable_clear_key(&empty.key);
+    slots[hole] = empty;
+
+    while (HTABLE_KEY_TAG(slots[next].key) != HTABLE_KEY_EMPTY) {
+        home = slots[next].hash % h->capacity;
+
+        if (home == next && h->method == ROBIN_HOOD) {
+            break;
         }
+        if (hole <= next ? (hole < home && home <= next)
+                : (hole < home || home <= next)) {
+            next = (next + 1) % h->capacity;
+            continue;
+        }
+        slots[hole] = slots[next];
+        slots[next] = empty;
+        hole = next;
+        next = (next + 1) % h->capacity;
+    }
+}
+
+/* 
+ * Remove the key in a slot of a hash table. Linear probing and Robin
+ * Hood tables shift the rest of the key's run back over it, double
+ * hashing tables leave a tombstone, since their probe sequences can't
+ * be followed backwards, and are rebuilt once tombstones fill a quarter
+ * of the slots. The table's key arena is rebuilt once deleted keys take
+ * up more of it than live ones.
+ * @param h a given hash table, with no rehash underway
+ * @param index the slot of the key to remove
+ */
+static void htable_remove(htable h, int index) {
+    size_t len;
 
-        if (strcmp(h->keys[index], str) == 0) {
-            return ++h->frequencies[index];
+    if (h->concurrent) {
+        free(h->slots[index].key.ptr); /* not in the arena */
+    } else if (HTABLE_KEY_TAG(h->slots[index].key) == HTABLE_KEY_LONG) {
+        len = strlen(h->slots[index].key.ptr) + 1;
+        h->live_bytes -= len;
+        h->dead_bytes += len;
+    }
+    h->num_keys--;
+
+    if (h->method == DOUBLE_H) {
+        htable_clear_key(&h->slots[index].key);
+        h->slots[index].hash = 0;
+        h->slots[index].frequency = HTABLE_TOMBSTONE;
+        h->tombstones++;
+        if (h->tombstones > h->capacity / HTABLE_TOMBSTONE_LIMIT) {
+            htable_rebuild(h);
         }
-    } while (index != index_origin);
+    } else {
+        htable_shift_back(h, index);
+    }
+
+    if (h->dead_bytes > h->live_bytes) {
+        htable_compact_keys(h);
+    }
+}
+
+/* 
+ * Delete a key from a hash table. Tables loaded from a snapshot can't be
+ * deleted from, and concurrent tables only once no other thread is using
+ * them.
+ * @param h a given hash table
+ * @param str the key to delete
+ * @return the frequency the key had, or 0 if it was not in the table
+ */
+int htable_delete(htable h, char *str) {
+    union htable_key key;
+    int index, collisions, place, freq;
+
+    if (h->map != NULL) {
+        return 0;
+    }
+
+    htable_finish_rehash(h);
+    HTABLE_COUNT(h->counters.deletes++);
+
+    htable_make_key(&key, str);
+    index = htable_probe(h, h->slots, h->capacity, &key, htable_hash(h, str),
+                         &collisions, &place);
+    if (index < 0) {
+        return 0;
+    }
+
+    freq = h->slots[index].frequency;
+    htable_remove(h, index);
+
+    return freq;
+}
+
+/* 
+ * Take one occurrence of a key away from a hash table, deleting the key
+ * once none are left, as htable_delete would.
+ * @param h a given hash table
+ * @param str the key to take an occurrence of
+ * @return the key's new frequency, 0 if it is gone or was not there
+ */
+int htable_decrement(htable h, char *str) {
+    union htable_key key;
+    int index, collisions, place;
+
+    if (h->map != NULL) {
+        return 0;
+    }
+
+    htable_finish_rehash(h);
+
+    htable_make_key(&key, str);
+    index = htable_probe(h, h->slots, h->capacity, &key, htable_hash(h, str),
+                         &collisions, &place);
+    if (index < 0) {
+        return 0;
+    }
+
+    if (h->slots[index].frequency > 1) {
+        return --h->slots[index].frequency;
+    }
+    HTABLE_COUNT(h->counters.deletes++);
+    htable_remove(h, index);
 
     return 0;
 }
 
+/* 
+ * Insert a value into a given hash table. Only tables made with
+ * htable_new_concurrent may be inserted into by several threads at once.
+ * @param h a given hash table
+ * @param str a value to insert 
+ * @return an integer to indicate insertion outcome
+ */
+int htable_insert(htable h, char *str) {
+    return htable_add(h, str, htable_hash(h, str), 1);
+}
+
+/* 
+ * Add every key of one hash table to another, summing the frequencies
+ * of keys found in both. The source table is left unchanged apart from
+ * completing any rehash it had underway. Stored hashes are reused when
+ * both tables hash the same way.
+ * @param h the hash table to merge into
+ * @param src the hash table to merge from
+ */
+void htable_merge(htable h, htable src) {
+    int same_hash = h->hashfn == src->hashfn && (h->hashfn != SIPHASH
+        || memcmp(h->sip_key, src->sip_key, sizeof h->sip_key) == 0);
+    char *key;
+    int i;
+
+    htable_finish_rehash(src);
+
+    for (i = 0; i < src->capacity; i++) {
+        key = htable_slot_key(&src->slots[i]);
+        if (key != NULL) {
+            htable_add(h, key, same_hash ? src->slots[i].hash
+                       : htable_hash(h, key), src->slots[i].frequency);
+        }
+    }
+}
+
 /*
- * Print values of a hash table.
+ * Print values of a hash table. Completes any rehash still underway.
+ * Short keys are passed from inside their slots, so they are only good
+ * until the table next changes.
  * @param h a given hash table
  * @param f a void function
  * @param freq the frequency count of a word
@@ -150,29 +1103,276 @@ int htable_insert(htable h, char *str) {
 void htable_print(htable h, void f(int freq, char *key)) {
     int i;
 
+    htable_finish_rehash(h);
+
+    for (i = 0; i < h->capacity; i++) {
+        if (h->slots[i].frequency > 0) {
+            f(h->slots[i].frequency, htable_slot_key(&h->slots[i]));
+        }
+    }
+}
+
+/* 
+ * Sort entries by key with insertion sort, comparing from a depth at
+ * which all the keys are known to agree.
+ * @param a the entries
+ * @param n the number of entries
+ * @param depth the number of leading bytes the keys share
+ */
+static void htable_insertion_sort(struct htable_entry *a, int n, int depth) {
+    struct htable_entry temp;
+    int i, j;
+
+    for (i = 1; i < n; i++) {
+        temp = a[i];
+        for (j = i; j > 0 && strcmp(a[j - 1].key + depth,
+                                    temp.key + depth) > 0; j--) {
+            a[j] = a[j - 1];
+        }
+        a[j] = temp;
+    }
+}
+
+/* 
+ * Sort entries by key with a most significant digit first radix sort,
+ * one byte per level. Each level reads the byte of every key once into
+ * an oracle array, then counts and moves the entries using the oracle
+ * alone, so the keys themselves are touched once per level rather than
+ * twice. Bytes shared by every key are skipped without moving anything.
+ * @param a the entries
+ * @param temp room for n entries to distribute into
+ * @param oracle room for n bytes
+ * @param n the number of entries
+ * @param depth the number of leading bytes the keys share
+ */
+static void htable_radix_sort(struct htable_entry *a, struct htable_entry *temp,
+                              unsigned char *oracle, int n, int depth) {
+    int counts[256], starts[256];
+    int i, c, start;
+
+    for (;;) {
+        if (n < HTABLE_RADIX_CUTOFF) {
+            htable_insertion_sort(a, n, depth);
+            return;
+        }
+
+        memset(counts, 0, sizeof counts);
+        for (i = 0; i < n; i++) {
+            oracle[i] = (unsigned char) a[i].key[depth];
+            counts[oracle[i]]++;
+        }
+        if (counts[oracle[0]] < n) {
+            break;
+        }
+        if (oracle[0] == '\0') {
+            return; /* every key ends here, so they are all equal */
+        }
+        depth++;
+    }
+
+    for (c = start = 0; c < 256; c++) {
+        starts[c] = start;
+        start += counts[c];
+    }
+    for (i = 0; i < n; i++) {
+        temp[starts[oracle[i]]++] = a[i];
+    }
+    memcpy(a, temp, n * sizeof a[0]);
+
+    /* keys that ended at this depth are already in place */
+    for (c = 1, start = counts[0]; c < 256; start += counts[c++]) {
+        if (counts[c] > 1) {
+            htable_radix_sort(a + start, temp, oracle, counts[c], depth + 1);
+        }
+    }
+}
+
+/* 
+ * Sort entries by descending frequency with a least significant digit
+ * first radix sort, one byte per pass. The passes are stable, so
+ * entries of equal frequency keep their order. Passes in which every
+ * frequency has the same byte are skipped, which leaves one or two
+ * passes for most tables.
+ * @param a the entries
+ * @param temp room for n entries
+ * @param n the number of entries
+ */
+static void htable_radix_sort_freqs(struct htable_entry *a,
+                                    struct htable_entry *temp, int n) {
+    struct htable_entry *from = a, *to = temp, *swap;
+    int counts[256];
+    unsigned int digit;
+    int i, c, start, shift;
+
+    for (shift = 0; shift < 32; shift += 8) {
+        memset(counts, 0, sizeof counts);
+        for (i = 0; i < n; i++) {
+            counts[(~(unsigned int) from[i].frequency >> shift) & 0xff]++;
+        }
+        digit = (~(unsigned int) from[0].frequency >> shift) & 0xff;
+        if (counts[digit] == n) {
+            continue;
+        }
+
+        for (c = start = 0; c < 256; c++) {
+            i = counts[c];
+            counts[c] = start;
+            start += i;
+        }
+        for (i = 0; i < n; i++) {
+            digit = (~(unsigned int) from[i].frequency >> shift) & 0xff;
+            to[counts[digit]++] = from[i];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != a) {
+        memcpy(a, from, n * sizeof a[0]);
+    }
+}
+
+/* 
+ * Print the values of a hash table in sorted order, either by key or by
+ * descending frequency with ties broken by key. The occupied slots are
+ * copied into an array and radix sorted there. Completes any rehash
+ * still underway.
+ * @param h a given hash table
+ * @param order BY_KEY or BY_FREQ
+ * @param f the function to print each value with
+ */
+void htable_print_sorted(htable h, order_t order,
+                         void f(int freq, char *key)) {
+    struct htable_entry *entries, *temp;
+    unsigned char *oracle;
+    int i, n = 0;
+
+    htable_finish_rehash(h);
+
+    entries = emalloc((h->num_keys + 1) * sizeof entries[0]);
     for (i = 0; i < h->capacity; i++) {
-        if (h->frequencies[i] > 0) {
-            f(h->frequencies[i], h->keys[i]);
+        if (HTABLE_KEY_TAG(h->slots[i].key) != HTABLE_KEY_EMPTY) {
+            entries[n].key = htable_slot_key(&h->slots[i]);
+            entries[n].frequency = h->slots[i].frequency;
+            n++;
+        }
+    }
+
+    if (n > 0) {
+        temp = emalloc(n * sizeof temp[0]);
+        oracle = emalloc(n);
+
+        htable_radix_sort(entries, temp, oracle, n, 0);
+        if (order == BY_FREQ) {
+            htable_radix_sort_freqs(entries, temp, n);
         }
+
+        free(oracle);
+        free(temp);
+    }
+
+    for (i = 0; i < n; i++) {
+        f(entries[i].frequency, entries[i].key);
     }
+
+    free(entries);
 }
 
 /* 
  * Print the entire contents of the hash table using specific formatting.
+ * Completes any rehash still underway.
  * @param h a given hash table
  * @param stream a file/s to print table contents to
  */
 void htable_print_entire_table(htable h, FILE *stream) {
     int i;
 
+    htable_finish_rehash(h);
+
     fprintf(stream, "  Pos  Freq  Stats  Word\n");
     fprintf(stream, "----------------------------------------\n");
 
     for (i = 0; i < h->capacity; i++) {
         fprintf(stream, "%5d %5d %5d   %s\n",
-            i, h->frequencies[i], h->stats[i], h->keys[i]);
+            i, h->slots[i].frequency, h->stats[i],
+            htable_slot_key(&h->slots[i]));
+    }
+}
+/* 
+ * Search a hash table loaded from a snapshot, probing the slots of the
+ * file in place just as htable_probe probes the slots of a live table.
+ * Loading checks only the header, so a slot whose key lies outside the
+ * key block is taken for a miss here rather than read.
+ * @param h a hash table made by htable_load
+ * @param str the value to search for in the table
+ * @param hash the hash of str
+ * @return the frequency of the value, or 0 if it is not in the table
+ */
+static int htable_search_mapped(htable h, char *str, unsigned int hash) {
+    struct htable_disk_slot *slots = h->disk_slots;
+    unsigned int index = hash % h->capacity;
+    unsigned int step = htable_step(h, h->capacity, index);
+    int i;
+
+    for (i = 0; i < h->capacity; i++) {
+        if (slots[index].key == 0 || (h->method == ROBIN_HOOD
+                && htable_distance(slots[index].hash, index, h->capacity) < i)) {
+            break;
+        }
+        if (slots[index].hash == hash
+                && slots[index].key < h->disk_keys_size) {
+            HTABLE_COUNT(h->counters.strcmps++);
+            if (strcmp(h->disk_keys + slots[index].key, str) == 0) {
+                HTABLE_COUNT(htable_count_search(h, 1, i));
+                return slots[index].frequency;
+            }
+        }
+        index = (index + step) % h->capacity;
+    }
+
+    HTABLE_COUNT(htable_count_search(h, 0, i));
+    return 0;
+}
+
+/* 
+ * Search a hash table for a value whose hash is already known.
+ * @param h a given hash table
+ * @param str the value to search for in the table
+ * @param hash the hash of str
+ * @return the frequency of the value, or 0 if it is not in the table
+ */
+static int htable_search_hashed(htable h, char *str, unsigned int hash) {
+    union htable_key key;
+    int collisions, old_collisions, place, index;
+
+    if (h->map != NULL) {
+        return htable_search_mapped(h, str, hash);
+    }
+
+    htable_make_key(&key, str);
+    index = htable_probe(h, h->slots, h->capacity, &key, hash, &collisions,
+                         &place);
+    if (index >= 0) {
+        HTABLE_COUNT(htable_count_search(h, 1, collisions));
+        return h->slots[index].frequency;
+    }
+
+    if (h->old_slots != NULL) {
+        index = htable_probe(h, h->old_slots, h->old_capacity, &key, hash,
+                             &old_collisions, &place);
+        collisions += old_collisions + 1;
+
+        if (index >= h->migrate_pos) {
+            HTABLE_COUNT(htable_count_search(h, 1, collisions));
+            return h->old_slots[index].frequency;
+        }
     }
+
+    HTABLE_COUNT(htable_count_search(h, 0, collisions));
+    return 0;
 }
+
 /* 
  * Search a hash table for a certain value. 
  * @param h a given hash table
@@ -182,29 +1382,204 @@ void htable_print_entire_table(htable h, FILE *stream) {
  */
 
 int htable_search(htable h, char *str) {
-    int collisions = 0;
-    unsigned int index = str_to_int(str) % h->capacity;
-    unsigned int step;
+    return htable_search_hashed(h, str, htable_hash(h, str));
+}
 
-    if (h->method == DOUBLE_H) {
-        step = htable_step(h, index);
-    } else {
-        step = 1;
+/* 
+ * Add an occurrence of a value only if it is already in a hash table.
+ * The value is hashed once for both the search and the insert.
+ * @param h a given hash table
+ * @param str the value to count
+ * @return the value's new frequency, 0 if it is not in the table
+ */
+int htable_increment(htable h, char *str) {
+    unsigned int hash = htable_hash(h, str);
+
+    if (htable_search_hashed(h, str, hash) == 0) {
+        return 0;
+    }
+    return htable_add(h, str, hash, 1);
+}
+
+/* 
+ * Search a hash table for many values at once. Each group of lookups is
+ * hashed and has its home slots prefetched first, then the keys in those
+ * slots are prefetched, and only then are the probes resolved, so the
+ * cache misses of a group overlap instead of stalling one after another.
+ * @param h a given hash table
+ * @param words the values to search for
+ * @param n the number of values
+ * @param freqs set to the frequency of each value, 0 if not present
+ */
+void htable_search_batch(htable h, char **words, int n, int *freqs) {
+    unsigned int hashes[HTABLE_BATCH], homes[HTABLE_BATCH];
+    char *key;
+    int i, j, m;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < HTABLE_BATCH ? n - i : HTABLE_BATCH;
+
+        for (j = 0; j < m; j++) {
+            hashes[j] = htable_hash(h, words[i + j]);
+            homes[j] = hashes[j] % h->capacity;
+            if (h->map != NULL) {
+                HTABLE_PREFETCH(&h->disk_slots[homes[j]]);
+            } else {
+                HTABLE_PREFETCH(&h->slots[homes[j]]);
+            }
+        }
+        for (j = 0; j < m; j++) {
+            if (h->map != NULL) {
+                key = h->disk_slots[homes[j]].key < h->disk_keys_size
+                    ? h->disk_keys + h->disk_slots[homes[j]].key : NULL;
+            } else if (HTABLE_KEY_TAG(h->slots[homes[j]].key)
+                       == HTABLE_KEY_LONG) {
+                key = h->slots[homes[j]].key.ptr;
+            } else {
+                key = NULL; /* in the slot, or no key */
+            }
+            if (key != NULL) {
+                HTABLE_PREFETCH(key);
+            }
+        }
+        for (j = 0; j < m; j++) {
+            freqs[i + j] = htable_search_hashed(h, words[i + j], hashes[j]);
+        }
     }
+}
+
+/* 
+ * Save a hash table to a snapshot file that htable_load can map back
+ * in. The slots are written as they stand, with each key replaced by
+ * its offset into a block of keys after them, so the file can be
+ * searched wherever it is mapped. Completes any rehash still underway
+ * and clears out any tombstones.
+ * @param h a given hash table
+ * @param stream the stream to write the snapshot to
+ * @return 1 if the snapshot was written, 0 otherwise
+ */
+int htable_save(htable h, FILE *stream) {
+    struct htable_header header;
+    struct htable_disk_slot *slots;
+    uint64_t keys_size = 1;
+    size_t len;
+    char *key;
+    int i, ok;
 
-    while (NULL != h->keys[index]
-           && strcmp(h->keys[index], str) != 0
-           && collisions < h->capacity) {
-        index += step;
-        index %= h->capacity;
-        collisions++;
+    htable_finish_rehash(h);
+    if (h->tombstones > 0) {
+        htable_rebuild(h); /* a free slot in the file ends a probe */
     }
 
-    if (collisions == h->capacity) {
-        return 0;
-    } else {
-        return h->frequencies[index];
+    slots = emalloc(h->capacity * sizeof slots[0]);
+    for (i = 0; i < h->capacity; i++) {
+        slots[i].hash = h->slots[i].hash;
+        slots[i].frequency = h->slots[i].frequency;
+        slots[i].key = 0;
+        key = htable_slot_key(&h->slots[i]);
+        if (key != NULL) {
+            slots[i].key = (uint32_t) keys_size;
+            keys_size += strlen(key) + 1;
+        }
+    }
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, HTABLE_MAGIC, sizeof header.magic);
+    header.version = HTABLE_VERSION;
+    header.byte_order = HTABLE_BYTE_ORDER;
+    header.method = h->method;
+    header.hashfn = h->hashfn;
+    header.capacity = h->capacity;
+    header.num_keys = h->num_keys;
+    header.sip_key[0] = h->sip_key[0];
+    header.sip_key[1] = h->sip_key[1];
+    header.slots_offset = sizeof header;
+    header.keys_offset = sizeof header + h->capacity * sizeof slots[0];
+    header.keys_size = keys_size;
+
+    ok = keys_size <= UINT32_MAX
+        && fwrite(&header, sizeof header, 1, stream) == 1
+        && fwrite(slots, sizeof slots[0], h->capacity, stream)
+            == (size_t) h->capacity
+        && fputc('\0', stream) != EOF;
+
+    for (i = 0; ok && i < h->capacity; i++) {
+        key = htable_slot_key(&h->slots[i]);
+        if (key != NULL) {
+            len = strlen(key) + 1;
+            ok = fwrite(key, 1, len, stream) == len;
+        }
+    }
+
+    free(slots);
+
+    return ok && fflush(stream) == 0;
+}
+
+/* 
+ * Load a hash table from a snapshot file written by htable_save. The
+ * file is mapped rather than read, so loading takes the same time
+ * whatever the size of the table, and searches probe the file in place.
+ * The table can be searched and freed but not added to.
+ * @param path the snapshot file
+ * @return the loaded hash table, or NULL if the file can't be mapped or
+ *  is not a snapshot this version understands
+ */
+htable htable_load(char *path) {
+    struct htable_header *header;
+    size_t size;
+    char *map = map_file(path, &size);
+    htable h;
+
+    if (map == NULL) {
+        return NULL;
+    }
+
+    header = (struct htable_header *) map;
+    if (size < sizeof *header
+            || memcmp(header->magic, HTABLE_MAGIC, sizeof header->magic) != 0
+            || header->version != HTABLE_VERSION
+            || header->byte_order != HTABLE_BYTE_ORDER
+            || header->method > ROBIN_HOOD || header->hashfn > SIPHASH
+            || header->capacity == 0 || header->capacity > INT32_MAX
+            || header->slots_offset != sizeof *header
+            || header->keys_offset != header->slots_offset
+                + header->capacity * sizeof(struct htable_disk_slot)
+            || header->keys_size == 0
+            || header->keys_offset + header->keys_size != size
+            || map[size - 1] != '\0'
+            || (header->method == DOUBLE_H && header->capacity < 2)) {
+        unmap_file(map, size);
+        return NULL;
     }
+
+    h = emalloc(sizeof *h);
+    h->slots = NULL;
+    h->num_keys = header->num_keys;
+    h->capacity = header->capacity;
+    h->stats = NULL;
+    h->method = header->method;
+    h->hashfn = header->hashfn;
+    h->sip_key[0] = header->sip_key[0];
+    h->sip_key[1] = header->sip_key[1];
+    h->max_load = 0.0;
+    h->old_slots = NULL;
+    h->old_capacity = 0;
+    h->migrate_pos = 0;
+    h->resizes = 0;
+    h->concurrent = 0;
+    h->tombstones = 0;
+    h->key_store = NULL;
+    h->live_bytes = 0;
+    h->dead_bytes = 0;
+    h->map = map;
+    h->map_size = size;
+    h->disk_slots = (struct htable_disk_slot *) (map + header->slots_offset);
+    h->disk_keys = map + header->keys_offset;
+    h->disk_keys_size = header->keys_size;
+    HTABLE_COUNT(memset(&h->counters, 0, sizeof h->counters));
+
+    return h;
 }
 
 /**
@@ -261,7 +1636,12 @@ void htable_print_stats(htable h, FILE *stream, int num_stats) {
     int i;
 
     fprintf(stream, "\n%s\n\n", 
-            h->method == LINEAR_P ? "Linear Probing" : "Double Hashing"); 
+            h->method == LINEAR_P ? "Linear Probing"
+            : h->method == DOUBLE_H ? "Double Hashing" : "Robin Hood Hashing"); 
+    if (h->resizes > 0) {
+        fprintf(stream, "Grown %d times to capacity %d, stats show "
+                "collisions as first inserted\n\n", h->resizes, h->capacity);
+    }
     fprintf(stream, "Percent   Current   Percent    Average      Maximum\n");
     fprintf(stream, " Full     Entries   At Home   Collisions   Collisions\n");
     fprintf(stream, "-----------------------------------------------------\n");
@@ -270,3 +1650,115 @@ void htable_print_stats(htable h, FILE *stream, int num_stats) {
     }
     fprintf(stream, "-----------------------------------------------------\n\n");
 }
+
+/**
+ * Prints a summary of how evenly the table's hash function spreads the
+ * keys over the buckets: how many buckets are home to 0, 1, 2... keys
+ * against the counts a uniform hash would give, a chi-squared test of
+ * uniformity and the longest run of occupied slots.
+ *
+ * @param h the hashtable to print diagnostics for.
+ * @param stream the stream to send output to.
+ */
+void htable_print_diagnostics(htable h, FILE *stream) {
+    int *home = emalloc(h->capacity * sizeof home[0]);
+    int occupancy[6] = {0, 0, 0, 0, 0, 0};
+    double lambda = (double) h->num_keys / h->capacity;
+    double chi_squared = 0.0, expected = exp(-lambda), remaining = 1.0;
+    double diff;
+    int i, run = 0, longest_run = 0, df = h->capacity - 1;
+
+    htable_finish_rehash(h);
+
+    for (i = 0; i < h->capacity; i++) {
+        home[i] = 0;
+    }
+    for (i = 0; i < h->capacity; i++) {
+        if (HTABLE_KEY_TAG(h->slots[i].key) != HTABLE_KEY_EMPTY) {
+            home[h->slots[i].hash % h->capacity]++;
+            run++;
+            if (run > longest_run) {
+                longest_run = run;
+            }
+        } else {
+            run = 0;
+        }
+    }
+    for (i = 0; i < h->capacity; i++) {
+        occupancy[home[i] < 5 ? home[i] : 5]++;
+        if (h->num_keys > 0) {
+            diff = home[i] - lambda;
+            chi_squared += diff * diff / lambda;
+        }
+    }
+
+    fprintf(stream, "\nHash Function Diagnostics (%s)\n\n",
+            hashfn_names[h->hashfn]);
+    fprintf(stream, "%d keys in %d buckets, load %.2f\n\n", h->num_keys,
+            h->capacity, lambda);
+    fprintf(stream, "Keys Per    Observed    Expected\n");
+    fprintf(stream, " Bucket      Buckets     Buckets\n");
+    fprintf(stream, "--------------------------------\n");
+    for (i = 0; i < 5; i++) {
+        fprintf(stream, "%5d  %11d %11.0f\n", i, occupancy[i],
+                expected * h->capacity);
+        remaining -= expected;
+        expected = expected * lambda / (i + 1);
+    }
+    fprintf(stream, "%5d+ %11d %11.0f\n", 5, occupancy[5],
+            remaining * h->capacity);
+    fprintf(stream, "--------------------------------\n");
+    if (h->num_keys > 0 && df > 0) {
+        fprintf(stream, "Chi-squared %.1f on %d degrees of freedom "
+                "(z = %.2f)\n", chi_squared, df,
+                (chi_squared - df) / sqrt(2.0 * df));
+    }
+    fprintf(stream, "Longest run of occupied slots %d\n\n", longest_run);
+
+    free(home);
+}
+
+/* 
+ * Copy out the operation counts of a hash table. Searches are counted
+ * from single threaded use only, inserts into a concurrent table are
+ * not counted.
+ * @param h a given hash table
+ * @param out set to the counts, all 0 when they are not kept
+ * @return 1 if the table was built with -DINSTRUMENT, 0 otherwise
+ */
+int htable_get_counters(htable h, struct htable_counters *out) {
+#ifdef INSTRUMENT
+    *out = h->counters;
+    return 1;
+#else
+    (void) h;
+    memset(out, 0, sizeof *out);
+    return 0;
+#endif
+}
+
+/* 
+ * Print the operation counts of a hash table as a JSON object.
+ * @param h a given hash table
+ * @param stream the stream to print to
+ */
+void htable_print_counters(htable h, FILE *stream) {
+    struct htable_counters c;
+
+    if (!htable_get_counters(h, &c)) {
+        fprintf(stream, "{\"instrumented\": false}\n");
+        return;
+    }
+
+    fprintf(stream, "{\"instrumented\": true, \"structure\": \"htable\", "
+            "\"capacity\": %d, \"keys\": %d,\n", h->capacity, h->num_keys);
+    fprintf(stream, " \"inserts\": %ld, \"deletes\": %ld, \"hits\": %ld, "
+            "\"misses\": %ld, \"strcmps\": %ld,\n ", c.inserts, c.deletes,
+            c.hits, c.misses, c.strcmps);
+    print_json_counts(stream, "hit_probes", c.hit_probes,
+                      HTABLE_PROBE_BUCKETS);
+    fprintf(stream, ",\n ");
+    print_json_counts(stream, "miss_probes", c.miss_probes,
+                      HTABLE_PROBE_BUCKETS);
+    fprintf(stream, "}\n");
+}
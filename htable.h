@@ -5,12 +5,49 @@
 
 /* Header file for hash table implementation */
 typedef struct htablerec *htable;
-typedef enum hashing_e {LINEAR_P, DOUBLE_H} hashing_t;
+typedef enum hashing_e {LINEAR_P, DOUBLE_H, ROBIN_HOOD} hashing_t;
+typedef enum hashfn_e {POLY31, FNV1A, WORD_MIX, SIPHASH} hashfn_t;
+typedef enum order_e {BY_KEY, BY_FREQ} order_t;
 
+/* Probe lengths of this many slots or more share the last bucket */
+#define HTABLE_PROBE_BUCKETS 32
+
+/* Operation counts a table keeps when built with -DINSTRUMENT. Probe
+   lengths count the slots looked at beyond a key's home slot */
+struct htable_counters {
+    long inserts;
+    long deletes;
+    long hits;
+    long misses;
+    long strcmps;
+    long hit_probes[HTABLE_PROBE_BUCKETS];
+    long miss_probes[HTABLE_PROBE_BUCKETS];
+};
+
+extern int htable_decrement(htable h, char *str);
+extern int htable_delete(htable h, char *str);
 extern void htable_free(htable h);
+extern int htable_get_counters(htable h, struct htable_counters *out);
+extern int htable_increment(htable h, char *str);
 extern int htable_insert(htable h, char *str);
-extern htable htable_new(int capacity, hashing_t method);
+extern htable htable_load(char *path);
+extern size_t htable_memory(htable h);
+extern void htable_merge(htable h, htable src);
+extern htable htable_new(int capacity, hashing_t method, hashfn_t hashfn);
+extern htable htable_new_concurrent(int capacity, hashing_t method,
+                                    hashfn_t hashfn);
+extern int htable_parse_hashfn(char *name, hashfn_t *hashfn);
 extern void htable_print(htable h, void f(int freq, char *key));
+extern void htable_print_sorted(htable h, order_t order,
+                                void f(int freq, char *key));
+extern int htable_save(htable h, FILE *stream);
 extern int htable_search(htable h, char *str);
+extern void htable_search_batch(htable h, char **words, int n, int *freqs);
+extern void htable_set_max_load(htable h, double max_load);
+extern size_t htable_slot_size(void);
+extern void htable_print_entire_table(htable h, FILE *stream);
+extern void htable_print_stats(htable h, FILE *stream, int num_stats);
+extern void htable_print_diagnostics(htable h, FILE *stream);
+extern void htable_print_counters(htable h, FILE *stream);
 
 #endif
@@ -1,9 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "mylib.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && defined(__SSE2__) && !defined(TOKENIZER_NO_SIMD)
+#define TOKENIZER_SIMD
+#include <immintrin.h>
+#endif
+
+/* Default number of bytes handed out by each arena chunk */
+#define ARENA_CHUNK_SIZE 65536
+
+/* Alignment of blocks handed out by arena_alloc, enough for pointers */
+#define ARENA_ALIGN 8
+
+/* A block of arena memory, its bytes follow the header */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+/* Generate arena struct */
+struct arenarec {
+    struct arena_chunk *chunks;
+};
+
+/* Default number of bytes read into a tokenizer buffer at a time */
+#define TOKENIZER_BUFSIZE 65536
+
+/* Spare bytes after the buffer so vector loads may run past its end.
+   Those loads can reach bytes no read has filled yet, so the buffer
+   starts out zeroed */
+#define TOKENIZER_PAD 32
+
+/* Returned by the vector scan when the scalar path must finish a word */
+#define TOKENIZER_SLOW (-2)
+
+/* Tokenizer byte classes */
+#define TOKEN_SEPARATOR 0
+#define TOKEN_ALNUM 1
+#define TOKEN_APOSTROPHE 2
+
+/* 
+ * Vector kernels for a tokenizer: word locates the next word in a block
+ * and lower lowercases ASCII in place.
+ */
+struct tokenizer_scan {
+    size_t (*word)(const unsigned char *p, size_t n, size_t *stop,
+                   int *quote);
+    void (*lower)(unsigned char *p, size_t n);
+};
+
+/* Generate tokenizer struct */
+struct tokenizerrec {
+    unsigned char class[256];
+    unsigned char lower[256];
+    const struct tokenizer_scan *scan;
+    int fd;
+    long offset;
+    long remaining;
+    char *buf;
+    size_t size;
+    size_t pos;
+    size_t end;
+    int eof;
+    char *held_at;
+    char held;
+};
+
+#ifdef TOKENIZER_SIMD
+/* 
+ * Lowercase the ASCII letters in the tail of a block one byte at a time.
+ * @param p the bytes to lowercase
+ * @param n the number of bytes
+ */
+static void lower_tail(unsigned char *p, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] >= 'A' && p[i] <= 'Z') {
+            p[i] += 'a' - 'A';
+        }
+    }
+}
+
+/* 
+ * Mark the bytes of a vector that are ASCII letters or digits. Bytes
+ * above 0x7f compare as negative so never match.
+ * @param v sixteen bytes to classify
+ * @return 0xff in each alnum byte, 0 elsewhere
+ */
+static __m128i sse2_alnum(__m128i v) {
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(
+        _mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+
+    return _mm_or_si128(digit, alpha);
+}
+
+/* 
+ * Locate the next word in a block, sixteen bytes at a time: its first
+ * alnum byte and the first byte after it that is neither alnum nor an
+ * apostrophe.
+ * @param p the bytes to scan
+ * @param n the number of bytes
+ * @param stop set to the offset of the separator ending the word, or n
+ * @param quote set nonzero if the word may hold an apostrophe
+ * @return the offset of the start of the word, or n if there is none
+ */
+static size_t sse2_word(const unsigned char *p, size_t n, size_t *stop,
+                        int *quote) {
+    size_t i, start;
+    unsigned int alnum, apos, sep;
+    __m128i v;
+
+    for (i = 0; ; i += 16) {
+        if (i >= n) {
+            return n;
+        }
+        v = _mm_loadu_si128((const __m128i *) (p + i));
+        alnum = _mm_movemask_epi8(sse2_alnum(v));
+        if (alnum != 0) {
+            break;
+        }
+    }
+
+    start = i + __builtin_ctz(alnum);
+    if (start >= n) {
+        return n;
+    }
+
+    apos = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\''))) 
+        & (0xffffu << (start - i));
+    sep = ~(alnum | apos) & (0xffffu << (start - i)) & 0xffff;
+    *quote = 0;
+
+    while (sep == 0) {
+        *quote |= apos;
+        i += 16;
+        if (i >= n) {
+            *stop = n;
+            return start;
+        }
+        v = _mm_loadu_si128((const __m128i *) (p + i));
+        alnum = _mm_movemask_epi8(sse2_alnum(v));
+        apos = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+        sep = ~(alnum | apos) & 0xffff;
+    }
+
+    *quote |= apos & ((1u << __builtin_ctz(sep)) - 1);
+    i += __builtin_ctz(sep);
+    *stop = i < n ? i : n;
+
+    return start;
+}
+
+/* 
+ * Lowercase the ASCII letters of a block in place.
+ * @param p the bytes to lowercase
+ * @param n the number of bytes
+ */
+static void sse2_lower(unsigned char *p, size_t n) {
+    size_t i;
+    __m128i v, upper;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (p + i));
+        upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                              _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+        v = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128((__m128i *) (p + i), v);
+    }
+    lower_tail(p + i, n - i);
+}
+
+/* 
+ * AVX2 versions of the kernels above, working on 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static __m256i avx2_alnum(__m256i v) {
+    __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i alpha = _mm256_and_si256(
+        _mm256_cmpgt_epi8(folded, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), folded));
+
+    return _mm256_or_si256(digit, alpha);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_word(const unsigned char *p, size_t n, size_t *stop,
+                        int *quote) {
+    size_t i, start;
+    unsigned int alnum, apos, sep;
+    __m256i v;
+
+    for (i = 0; ; i += 32) {
+        if (i >= n) {
+            return n;
+        }
+        v = _mm256_loadu_si256((const __m256i *) (p + i));
+        alnum = _mm256_movemask_epi8(avx2_alnum(v));
+        if (alnum != 0) {
+            break;
+        }
+    }
+
+    start = i + __builtin_ctz(alnum);
+    if (start >= n) {
+        return n;
+    }
+
+    apos = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,
+               _mm256_set1_epi8('\''))) & (~0u << (start - i));
+    sep = ~(alnum | apos) & (~0u << (start - i));
+    *quote = 0;
+
+    while (sep == 0) {
+        *quote |= apos;
+        i += 32;
+        if (i >= n) {
+            *stop = n;
+            return start;
+        }
+        v = _mm256_loadu_si256((const __m256i *) (p + i));
+        alnum = _mm256_movemask_epi8(avx2_alnum(v));
+        apos = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,
+                   _mm256_set1_epi8('\'')));
+        sep = ~(alnum | apos);
+    }
+
+    *quote |= apos & ((1u << __builtin_ctz(sep)) - 1);
+    i += __builtin_ctz(sep);
+    *stop = i < n ? i : n;
+
+    return start;
+}
+
+__attribute__((target("avx2")))
+static void avx2_lower(unsigned char *p, size_t n) {
+    size_t i;
+    __m256i v, upper;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (p + i));
+        upper = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+        v = _mm256_add_epi8(v, _mm256_and_si256(upper,
+                                                _mm256_set1_epi8(0x20)));
+        _mm256_storeu_si256((__m256i *) (p + i), v);
+    }
+    lower_tail(p + i, n - i);
+}
+
+static const struct tokenizer_scan sse2_scan = {
+    sse2_word, sse2_lower
+};
+
+static const struct tokenizer_scan avx2_scan = {
+    avx2_word, avx2_lower
+};
+
+/* 
+ * Check that a tokenizer's ctype tables are plain ASCII, which is what
+ * the vector kernels assume. Other locales stay on the scalar path.
+ * @param t the tokenizer to check
+ * @return 1 if the tables match ASCII, 0 otherwise
+ */
+static int tokenizer_tables_ascii(tokenizer t) {
+    int c, alnum;
+
+    for (c = 0; c < 256; c++) {
+        alnum = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+            || (c >= 'A' && c <= 'Z');
+        if ((TOKEN_ALNUM == t->class[c]) != alnum
+                || t->lower[c] != (c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+#endif
+
 /* 
  * Retrieves a word from a file. Repeat until no words await reading
  * in the file.
@@ -39,6 +335,278 @@ int getword(char *s, int limit, FILE *stream) {
     return w - s;
 }
 
+/* 
+ * Create a tokenizer that reads a stream in large blocks.
+ * @param stream the file to read words from
+ * @return the new tokenizer
+ */
+tokenizer tokenizer_new(FILE *stream) {
+    tokenizer t = emalloc(sizeof *t);
+    int c;
+
+    assert(stream != NULL);
+
+    /* Tables built from ctype so the rules match getword exactly */
+    for (c = 0; c < 256; c++) {
+        t->class[c] = isalnum(c) ? TOKEN_ALNUM
+            : '\'' == c ? TOKEN_APOSTROPHE : TOKEN_SEPARATOR;
+        t->lower[c] = tolower(c);
+    }
+
+    /* Pick the widest vector kernels this CPU runs, if any */
+    t->scan = NULL;
+#ifdef TOKENIZER_SIMD
+    if (tokenizer_tables_ascii(t)) {
+        __builtin_cpu_init();
+        t->scan = __builtin_cpu_supports("avx2") ? &avx2_scan : &sse2_scan;
+    }
+#endif
+
+    t->fd = fileno(stream);
+    t->offset = 0;
+    t->remaining = -1;
+    t->size = TOKENIZER_BUFSIZE;
+    t->buf = emalloc(t->size + 1 + TOKENIZER_PAD);
+    memset(t->buf, 0, t->size + 1 + TOKENIZER_PAD);
+    t->pos = 0;
+    t->end = 0;
+    t->eof = 0;
+    t->held_at = NULL;
+
+    return t;
+}
+
+/* 
+ * Create a tokenizer that reads only part of a file, so that several
+ * threads can each take a share of one input.
+ * @param stream the file to read words from, which must be seekable
+ * @param offset the position of the first byte to read
+ * @param len the number of bytes to read
+ * @return the new tokenizer
+ */
+tokenizer tokenizer_new_range(FILE *stream, long offset, long len) {
+    tokenizer t = tokenizer_new(stream);
+
+    t->offset = offset;
+    t->remaining = len;
+
+    return t;
+}
+
+/* 
+ * Find the first place at or after an offset where a file can be split
+ * without cutting a word in two, that is just past a byte that is
+ * neither alnum nor an apostrophe.
+ * @param stream the file to split, which must be seekable
+ * @param offset the position to start looking from
+ * @return the position to split at, or the end of the file
+ */
+long tokenizer_boundary(FILE *stream, long offset) {
+    unsigned char buf[4096];
+    ssize_t n, i;
+
+    while ((n = pread(fileno(stream), buf, sizeof buf, offset)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (!isalnum(buf[i]) && '\'' != buf[i]) {
+                return offset + i + 1;
+            }
+        }
+        offset += n;
+    }
+
+    return offset;
+}
+
+/* 
+ * Read the next block of the stream into a tokenizer's buffer, keeping
+ * the bytes from keep onwards at the front of the buffer. With vector
+ * kernels the new bytes are lowercased as they arrive.
+ * @param t the tokenizer to fill
+ * @param keep the offset of the first byte still in use
+ * @return the number of bytes the kept data moved down by
+ */
+static size_t tokenizer_fill(tokenizer t, size_t keep) {
+    ssize_t n;
+
+    memmove(t->buf, t->buf + keep, t->end - keep);
+    t->end -= keep;
+    t->pos -= keep;
+
+    do {
+        if (t->remaining < 0) {
+            n = read(t->fd, t->buf + t->end, t->size - t->end);
+        } else if (t->remaining > 0) {
+            n = pread(t->fd, t->buf + t->end, (size_t) t->remaining
+                      < t->size - t->end ? (size_t) t->remaining
+                      : t->size - t->end, t->offset);
+        } else {
+            n = 0;
+        }
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0 && t->remaining > 0) {
+        t->offset += n;
+        t->remaining -= n;
+    }
+
+    if (n <= 0) {
+        t->eof = 1;
+    } else {
+        if (t->scan != NULL) {
+            t->scan->lower((unsigned char *) t->buf + t->end, n);
+        }
+        t->end += n;
+    }
+
+    return keep;
+}
+
+/* 
+ * Find the next word with a tokenizer's vector kernels. This handles
+ * every word that ends inside the buffer with no apostrophes and no
+ * need to split, returning it in place.
+ * @param t the tokenizer to read from
+ * @param word set to the start of the nul terminated word
+ * @param limit word check boundary
+ * @return the length of the word, EOF when no words remain, or
+ *  TOKENIZER_SLOW with t->pos at the word's first byte when the scalar
+ *  path must finish the word
+ */
+static int tokenizer_scan_word(tokenizer t, char **word, int limit) {
+    unsigned char *buf;
+    size_t pos, stop;
+    int quote;
+
+    for (;;) {
+        buf = (unsigned char *) t->buf;
+        pos = t->pos + t->scan->word(buf + t->pos, t->end - t->pos, &stop,
+                                     &quote);
+        stop += t->pos;
+        t->pos = pos;
+
+        if (pos < t->end) {
+            break;
+        }
+        if (t->eof) {
+            return EOF;
+        }
+        tokenizer_fill(t, t->end);
+    }
+
+    if ((stop < t->end || t->eof) && stop - pos < (size_t) limit && !quote) {
+        buf[stop] = '\0';
+        t->pos = stop < t->end ? stop + 1 : stop;
+        *word = (char *) buf + pos;
+        return stop - pos;
+    }
+
+    return TOKENIZER_SLOW;
+}
+
+/* 
+ * Retrieve the next word from a tokenizer. Words follow the same rules
+ * as getword: they start at an alphanumeric character, are lowercased,
+ * skip apostrophes and are cut after limit - 1 characters. The word is
+ * lowercased in place in the tokenizer's buffer and stays valid until
+ * the next call.
+ * @param t the tokenizer to read from
+ * @param word set to the start of the nul terminated word
+ * @param limit word check boundary
+ * @return the length of the word, or EOF when no words remain
+ */
+int tokenizer_next(tokenizer t, char **word, int limit) {
+    unsigned char *buf;
+    size_t pos, end, start, w;
+    int c, len = 0, ended = 0;
+
+    assert(limit > 1 && word != NULL);
+
+    if (t->held_at != NULL) {
+        *t->held_at = t->held;
+        t->held_at = NULL;
+    }
+
+    if (t->size < 2 * (size_t) limit) {
+        w = t->size;
+        t->size = 2 * (size_t) limit;
+        t->buf = erealloc(t->buf, t->size + 1 + TOKENIZER_PAD);
+        memset(t->buf + w + 1 + TOKENIZER_PAD, 0, t->size - w);
+    }
+
+    if (t->scan != NULL) {
+        len = tokenizer_scan_word(t, word, limit);
+        if (len != TOKENIZER_SLOW) {
+            return len;
+        }
+        len = 0;
+    }
+
+    for (;;) {
+        buf = (unsigned char *) t->buf;
+        pos = t->pos;
+        end = t->end;
+
+        while (pos < end && t->class[buf[pos]] != TOKEN_ALNUM) {
+            pos++;
+        }
+        t->pos = pos;
+
+        if (pos < end) {
+            break;
+        }
+        if (t->eof) {
+            return EOF;
+        }
+        tokenizer_fill(t, end);
+    }
+
+    start = w = pos;
+
+    for (;;) {
+        while (pos < end && len < limit - 1) {
+            c = buf[pos++];
+
+            if (TOKEN_ALNUM == t->class[c]) {
+                buf[w++] = t->lower[c];
+                len++;
+            } else if (TOKEN_SEPARATOR == t->class[c]) {
+                ended = 1;
+                break;
+            }
+        }
+        if (ended || len == limit - 1 || t->eof) {
+            break;
+        }
+        /* Only the word so far needs keeping, skipped apostrophes can go */
+        t->pos = t->end = w;
+        w -= tokenizer_fill(t, start);
+        start = 0;
+        buf = (unsigned char *) t->buf;
+        pos = t->pos;
+        end = t->end;
+    }
+
+    t->pos = pos;
+
+    if (w == pos && pos < end) {
+        t->held_at = t->buf + w;
+        t->held = t->buf[w];
+    }
+    t->buf[w] = '\0';
+    *word = t->buf + start;
+
+    return len;
+}
+
+/* 
+ * Free a tokenizer. The stream it reads from is left open.
+ * @param t the tokenizer to free
+ */
+void tokenizer_free(tokenizer t) {
+    free(t->buf);
+    free(t);
+}
+
 /* 
  * Memory allocation function.
  * @param s the size of memory for malloc to allocate
@@ -69,3 +637,193 @@ void *erealloc(void *ptr, size_t s) {
 
     return out;
 }
+
+/*
+ * Checks if a number given by the user is a prime number.
+ * @param n a number to check
+ * @return an integer indicating whether or not the number is a prime number
+ */
+int is_prime(int n) {
+    int i;
+
+    if (n < 2) {
+        return 0;
+    }
+
+    for (i = 2; i*i <= n; i++) {
+        if (n % i == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Returns the next highest prime greater than a given value.
+ * @param i the base number
+ * @return the next highest prime
+ */
+int next_highest_prime(int i) {
+    int j;
+
+    for (j = i; ; j++) {
+        if (1 == is_prime(j)) {
+            return j;
+        }
+    }
+}
+
+/* 
+ * Create a new arena. Strings and blocks taken from the arena are
+ * packed one after another in large chunks and released all at once.
+ * @return the new, empty arena
+ */
+arena arena_new(void) {
+    arena a = emalloc(sizeof *a);
+
+    a->chunks = NULL;
+
+    return a;
+}
+
+/* 
+ * Take bytes from an arena, starting a new chunk when the current one
+ * has no room left. Blocks longer than a chunk get one of their own.
+ * @param a the arena to take from
+ * @param size the number of bytes
+ * @param align the alignment of the bytes, a power of two
+ * @return the bytes
+ */
+static char *arena_take(arena a, size_t size, size_t align) {
+    struct arena_chunk *c = a->chunks;
+    size_t start = c == NULL ? 0 : (c->used + align - 1) & ~(align - 1);
+
+    if (c == NULL || c->size < start + size) {
+        size_t chunk = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+        c = emalloc(sizeof *c + chunk);
+        c->next = a->chunks;
+        c->size = chunk;
+        a->chunks = c;
+        start = 0;
+    }
+
+    c->used = start + size;
+
+    return (char *) (c + 1) + start;
+}
+
+/* 
+ * Copy a string into an arena. Strings are packed one after another.
+ * @param a the arena to copy into
+ * @param str the string to copy
+ * @return the copy held by the arena
+ */
+char *arena_strdup(arena a, char *str) {
+    size_t len = strlen(str) + 1;
+    char *out = arena_take(a, len, 1);
+
+    memcpy(out, str, len);
+
+    return out;
+}
+
+/* 
+ * Allocate a block from an arena, aligned for any pointer or integer.
+ * The block is released with the rest of the arena.
+ * @param a the arena to allocate from
+ * @param size the number of bytes
+ * @return the block
+ */
+void *arena_alloc(arena a, size_t size) {
+    return arena_take(a, size, ARENA_ALIGN);
+}
+
+/* 
+ * Free an arena along with every string copied into it.
+ * @param a the arena to free
+ */
+void arena_free(arena a) {
+    struct arena_chunk *c, *next;
+
+    for (c = a->chunks; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+
+    free(a);
+}
+
+/* 
+ * Map a whole file into memory read-only. Pages are read in lazily as
+ * they are touched, so mapping costs the same whatever the file's size.
+ * @param path the file to map
+ * @param size set to the size of the file
+ * @return the start of the mapping, or NULL if the file can't be mapped
+ */
+void *map_file(char *path, size_t *size) {
+    struct stat st;
+    void *out;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    out = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (out == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t) st.st_size;
+
+    return out;
+}
+
+/* 
+ * Release a mapping made by map_file.
+ * @param map the start of the mapping
+ * @param size the size of the mapping
+ */
+void unmap_file(void *map, size_t size) {
+    munmap(map, size);
+}
+
+/*
+ * Read the monotonic clock, which wall clock adjustments don't disturb.
+ * @return seconds since an arbitrary fixed point
+ */
+double seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Print a histogram as a named JSON array, leaving off the empty
+ * buckets at its end.
+ * @param stream the stream to print to
+ * @param name the name of the array
+ * @param counts the counts of the buckets
+ * @param n the number of buckets
+ */
+void print_json_counts(FILE *stream, char *name, long *counts, int n) {
+    int i;
+
+    while (n > 0 && counts[n - 1] == 0) {
+        n--;
+    }
+
+    fprintf(stream, "\"%s\": [", name);
+    for (i = 0; i < n; i++) {
+        fprintf(stream, i == 0 ? "%ld" : ", %ld", counts[i]);
+    }
+    fprintf(stream, "]");
+}
@@ -1,10 +1,28 @@
-#ifndef MYLIB_H_
-#define MYLIB_H_
-
-#include <stddef.h>
-/* Header file for mylib implementations. */
-extern int getword(char *s, int limit, FILE *stream);
-extern void *emalloc(size_t s);
-extern void *erealloc(void *ptr, size_t s);
-
-#endif
+#ifndef MYLIB_H_
+#define MYLIB_H_
+
+#include <stddef.h>
+/* Header file for mylib implementations. */
+typedef struct arenarec *arena;
+typedef struct tokenizerrec *tokenizer;
+
+extern int getword(char *s, int limit, FILE *stream);
+extern tokenizer tokenizer_new(FILE *stream);
+extern tokenizer tokenizer_new_range(FILE *stream, long offset, long len);
+extern long tokenizer_boundary(FILE *stream, long offset);
+extern int tokenizer_next(tokenizer t, char **word, int limit);
+extern void tokenizer_free(tokenizer t);
+extern void *emalloc(size_t s);
+extern void *erealloc(void *ptr, size_t s);
+extern int is_prime(int n);
+extern int next_highest_prime(int i);
+extern arena arena_new(void);
+extern char *arena_strdup(arena a, char *str);
+extern void *arena_alloc(arena a, size_t size);
+extern void arena_free(arena a);
+extern void *map_file(char *path, size_t *size);
+extern void unmap_file(void *map, size_t size);
+extern double seconds(void);
+extern void print_json_counts(FILE *stream, char *name, long *counts, int n);
+
+#endif
@@ -0,0 +1,452 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htable.h"
+#include "sketch.h"
+#include "mylib.h"
+
+/* Most rows a sketch may have */
+#define SKETCH_MAX_DEPTH 16
+
+/* Fewest counters a row may have */
+#define SKETCH_MIN_WIDTH 64
+
+/* Multipliers for the sketch's string hash */
+#define SKETCH_K1 UINT64_C(0xff51afd7ed558ccd)
+#define SKETCH_K2 UINT64_C(0x9e3779b97f4a7c15)
+
+/* Fewest words a heavy hitter table tracks, and how many it tracks
+   for each word asked for */
+#define HITTERS_MIN_TRACKED 256
+#define HITTERS_PER_WORD 8
+
+/* Bytes a tracked word is budgeted for: two slots of its table with
+   their probe stats, and its scratch entry */
+#define HITTERS_WORD_BYTES \
+    (2 * (long) htable_slot_size() + (long) sizeof(struct hitter))
+
+/* Rows of a heavy hitter table's sketch, e^-5 < 1% chance of a bad
+   estimate */
+#define HITTERS_DEPTH 5
+
+/* Generate sketch struct, depth rows of width saturating counters */
+struct sketchrec {
+    uint32_t *counters;
+    long width;
+    int depth;
+    long total;
+};
+
+/* A tracked word with its estimated frequency */
+struct hitter {
+    long estimate;
+    long lower;
+    char *word;
+};
+
+/* Generate heavy hitter struct. Words whose estimate reaches threshold
+   are counted exactly in tracked from then on instead of in the sketch.
+   The occurrence that brought a word in is in both, so a tracked word's
+   estimate is its sketch estimate plus one less than its count in
+   tracked, and is at least threshold */
+struct hittersrec {
+    sketch counts;
+    htable tracked;
+    long words;
+    int k;
+    int limit;
+    int num_tracked;
+    long threshold;
+    struct hitter *scratch;
+};
+
+/* The table htable_print is walking over, and where its words go */
+static struct hitter *collecting = NULL;
+static int num_collected = 0;
+
+/* 
+ * Hash a string eight bytes at a time into 64 bits, the two halves of
+ * which pick a word's counter in every row.
+ * @param str the string to hash
+ * @return the 64-bit hash
+ */
+static uint64_t sketch_hash(char *str) {
+    size_t len = strlen(str);
+    uint64_t out = SKETCH_K1 ^ len, w;
+
+    for (; len >= 8; str += 8, len -= 8) {
+        memcpy(&w, str, 8);
+        out = (out ^ w) * SKETCH_K2;
+        out ^= out >> 29;
+    }
+
+    w = 0;
+    memcpy(&w, str, len);
+    out = (out ^ w) * SKETCH_K2;
+    out ^= out >> 32;
+    out *= SKETCH_K1;
+    out ^= out >> 29;
+
+    return out;
+}
+
+/* 
+ * Find the counters of a word, one per row. Row i takes the counter at
+ * h1 + i * h2 scaled into the width, which behaves as well as depth
+ * independent hashes would for the bounds of a sketch.
+ * @param s the sketch
+ * @param str the word
+ * @param cells set to the word's counters
+ */
+static void sketch_cells(sketch s, char *str, uint32_t **cells) {
+    uint64_t hash = sketch_hash(str);
+    uint32_t h1 = (uint32_t) hash, h2 = (uint32_t) (hash >> 32) | 1;
+    int i;
+
+    for (i = 0; i < s->depth; i++, h1 += h2) {
+        cells[i] = s->counters + i * s->width
+            + (long) (((uint64_t) h1 * (uint64_t) s->width) >> 32);
+    }
+}
+
+/* 
+ * Create a Count-Min sketch that fits in a number of bytes. With width
+ * w counters in each of d rows, an estimate is never below a word's
+ * true count and exceeds it by no more than e/w of all words counted
+ * with probability 1 - e^-d.
+ * @param bytes the memory the counters may take
+ * @param depth the number of rows, between 1 and 16
+ * @return the new, empty sketch
+ */
+sketch sketch_new(long bytes, int depth) {
+    sketch s = emalloc(sizeof *s);
+
+    s->depth = depth < 1 ? 1 : depth > SKETCH_MAX_DEPTH ? SKETCH_MAX_DEPTH
+        : depth;
+    s->width = bytes / (s->depth * (long) sizeof s->counters[0]);
+    if (s->width < SKETCH_MIN_WIDTH) {
+        s->width = SKETCH_MIN_WIDTH;
+    }
+    s->total = 0;
+    s->counters = emalloc(s->width * s->depth * sizeof s->counters[0]);
+    memset(s->counters, 0, s->width * s->depth * sizeof s->counters[0]);
+
+    return s;
+}
+
+/* 
+ * Count occurrences of a word. This is a conservative update: only the
+ * counters at the word's current minimum are raised, since raising the
+ * others can't change its estimate, which keeps collisions from
+ * inflating other words' estimates as much.
+ * @param s the sketch
+ * @param str the word
+ * @param count the number of occurrences to count
+ * @return the word's estimated frequency after counting them
+ */
+long sketch_add(sketch s, char *str, long count) {
+    uint32_t *cells[SKETCH_MAX_DEPTH];
+    uint32_t min = UINT32_MAX;
+    int i;
+
+    sketch_cells(s, str, cells);
+    for (i = 0; i < s->depth; i++) {
+        if (*cells[i] < min) {
+            min = *cells[i];
+        }
+    }
+    min = count < (long) (UINT32_MAX - min) ? min + (uint32_t) count
+        : UINT32_MAX;
+    for (i = 0; i < s->depth; i++) {
+        if (*cells[i] < min) {
+            *cells[i] = min;
+        }
+    }
+    s->total += count;
+
+    return (long) min;
+}
+
+/* 
+ * Estimate how often a word has been counted.
+ * @param s the sketch
+ * @param str the word
+ * @return the estimate, which is never below the true count
+ */
+long sketch_estimate(sketch s, char *str) {
+    uint32_t *cells[SKETCH_MAX_DEPTH];
+    uint32_t min = UINT32_MAX;
+    int i;
+
+    sketch_cells(s, str, cells);
+    for (i = 0; i < s->depth; i++) {
+        if (*cells[i] < min) {
+            min = *cells[i];
+        }
+    }
+
+    return (long) min;
+}
+
+/* 
+ * The most an estimate overcounts by, barring bad luck.
+ * @param s the sketch
+ * @return e/w times the number of words counted
+ */
+double sketch_error(sketch s) {
+    return exp(1.0) / s->width * s->total;
+}
+
+/* 
+ * The probability that an estimate is within sketch_error of the
+ * true count.
+ * @param s the sketch
+ * @return 1 - e^-d
+ */
+double sketch_confidence(sketch s) {
+    return 1.0 - exp(-s->depth);
+}
+
+/* 
+ * Size of a sketch's counters.
+ * @param s the sketch
+ * @return the number of bytes of counters
+ */
+long sketch_size(sketch s) {
+    return s->width * s->depth * (long) sizeof s->counters[0];
+}
+
+/* 
+ * Number of words a sketch has counted.
+ * @param s the sketch
+ * @return the number of occurrences given to sketch_add
+ */
+long sketch_total(sketch s) {
+    return s->total;
+}
+
+/* 
+ * Free a sketch.
+ * @param s the sketch to free
+ */
+void sketch_free(sketch s) {
+    free(s->counters);
+    free(s);
+}
+
+/* 
+ * Add a tracked word to the array being collected.
+ * @param freq the word's count since it was tracked
+ * @param word the word
+ */
+static void collect_hitter(int freq, char *word) {
+    collecting[num_collected].lower = freq;
+    collecting[num_collected].word = word;
+    num_collected++;
+}
+
+/* 
+ * Order two tracked words heaviest first, ties going to the word that
+ * sorts first.
+ * @param a a hitter
+ * @param b another hitter
+ * @return negative if a comes first, positive if b does
+ */
+static int hitter_cmp(const void *a, const void *b) {
+    const struct hitter *x = a, *y = b;
+
+    if (x->estimate != y->estimate) {
+        return x->estimate > y->estimate ? -1 : 1;
+    }
+    return strcmp(x->word, y->word);
+}
+
+/* 
+ * Gather the tracked words of a heavy hitter table into its scratch
+ * array with their current estimates, heaviest first.
+ * @param t the heavy hitter table
+ * @return the number of words gathered
+ */
+static int hitters_collect(hitters t) {
+    int i;
+
+    collecting = t->scratch;
+    num_collected = 0;
+    htable_print(t->tracked, collect_hitter);
+    collecting = NULL;
+
+    for (i = 0; i < num_collected; i++) {
+        t->scratch[i].estimate = t->scratch[i].lower - 1
+            + sketch_estimate(t->counts, t->scratch[i].word);
+    }
+    qsort(t->scratch, num_collected, sizeof t->scratch[0], hitter_cmp);
+
+    return num_collected;
+}
+
+/* 
+ * Stop tracking the lighter half of the words of a full heavy hitter
+ * table, and raise the threshold to the lightest word kept. The counts
+ * of the dropped words go back into the sketch, so their estimates
+ * stay bounds.
+ * @param t the heavy hitter table
+ */
+static void hitters_prune(hitters t) {
+    int i, n = hitters_collect(t), keep = (n + 1) / 2;
+    arena doomed;
+    char **words;
+
+    /* deleting may move the table's keys, so copy the doomed ones out */
+    doomed = arena_new();
+    words = emalloc((n - keep) * sizeof words[0]);
+    for (i = keep; i < n; i++) {
+        if (t->scratch[i].lower > 1) {
+            sketch_add(t->counts, t->scratch[i].word,
+                       t->scratch[i].lower - 1);
+        }
+        words[i - keep] = arena_strdup(doomed, t->scratch[i].word);
+    }
+    for (i = 0; i < n - keep; i++) {
+        htable_delete(t->tracked, words[i]);
+    }
+    free(words);
+    arena_free(doomed);
+
+    t->num_tracked = keep;
+    t->threshold = t->scratch[keep - 1].estimate;
+}
+
+/* 
+ * Create a table of the heaviest words of a stream that fits in a
+ * memory budget whatever the stream's length. Words are counted in a
+ * Count-Min sketch until their estimate reaches a threshold, and from
+ * then on exactly in a hash table of fixed size. Keeping the heaviest
+ * words out of the sketch makes it both faster and more accurate for
+ * the rest. When the hash table fills, the lighter half of its words
+ * are dropped and the threshold rises.
+ * @param budget the bytes the sketch and hash table may take, apart
+ *  from the tracked keys themselves
+ * @param k the number of heaviest words that will be asked for
+ * @return the new table, or NULL if the budget can't fit a sketch
+ *  next to the words that need tracking
+ */
+hitters hitters_new(long budget, int k) {
+    hitters t;
+    int limit;
+
+    k = k > 0 ? k : 1;
+    limit = k < HITTERS_MIN_TRACKED / HITTERS_PER_WORD ? HITTERS_MIN_TRACKED
+        : HITTERS_PER_WORD * k;
+    budget -= (long) limit * HITTERS_WORD_BYTES;
+    if (budget < SKETCH_MIN_WIDTH * (long) sizeof(uint32_t)) {
+        return NULL;
+    }
+
+    t = emalloc(sizeof *t);
+    t->counts = sketch_new(budget, HITTERS_DEPTH);
+    t->tracked = htable_new(next_highest_prime(2 * limit), LINEAR_P,
+                            WORD_MIX);
+    t->words = 0;
+    t->k = k;
+    t->limit = limit;
+    t->num_tracked = 0;
+    t->threshold = 1;
+    t->scratch = emalloc(limit * sizeof t->scratch[0]);
+
+    return t;
+}
+
+/* 
+ * Count an occurrence of a word.
+ * @param t the heavy hitter table
+ * @param str the word
+ */
+void hitters_add(hitters t, char *str) {
+    t->words++;
+    if (htable_increment(t->tracked, str) == 0
+            && sketch_add(t->counts, str, 1) >= t->threshold) {
+        htable_insert(t->tracked, str);
+        if (++t->num_tracked == t->limit) {
+            hitters_prune(t);
+        }
+    }
+}
+
+/* 
+ * Estimate how often a heavy hitter table has counted a word.
+ * @param t the heavy hitter table
+ * @param str the word
+ * @return the estimate, which is never below the true count
+ */
+long hitters_estimate(hitters t, char *str) {
+    long freq = htable_search(t->tracked, str);
+
+    return sketch_estimate(t->counts, str) + (freq > 0 ? freq - 1 : 0);
+}
+
+/* 
+ * Print the heaviest words of a heavy hitter table, heaviest first.
+ * Each comes with bounds on its true frequency: its estimate is never
+ * too low, and it occurred at least as often as it was counted while
+ * tracked. With probability sketch_confidence the estimate is also
+ * within sketch_error of the true frequency.
+ * @param t the heavy hitter table
+ * @param f the function to print each word with
+ */
+void hitters_print(hitters t, void f(long estimate, long lower,
+                                     char *word)) {
+    int i, n = hitters_collect(t);
+
+    for (i = 0; i < n && i < t->k; i++) {
+        f(t->scratch[i].estimate, t->scratch[i].lower, t->scratch[i].word);
+    }
+}
+
+/* 
+ * The sketch a heavy hitter table counts every word in.
+ * @param t the heavy hitter table
+ * @return the sketch
+ */
+sketch hitters_counts(hitters t) {
+    return t->counts;
+}
+
+/* 
+ * Size of a heavy hitter table, not counting its tracked keys.
+ * @param t the heavy hitter table
+ * @return the bytes taken by its sketch, slots and scratch space
+ */
+long hitters_size(hitters t) {
+    return sketch_size(t->counts) + (long) t->limit * HITTERS_WORD_BYTES;
+}
+
+/* 
+ * Number of words a heavy hitter table has counted.
+ * @param t the heavy hitter table
+ * @return the number of calls to hitters_add
+ */
+long hitters_words(hitters t) {
+    return t->words;
+}
+
+/* 
+ * Number of words a heavy hitter table is tracking.
+ * @param t the heavy hitter table
+ * @return the number of words counted exactly
+ */
+int hitters_tracked(hitters t) {
+    return t->num_tracked;
+}
+
+/* 
+ * Free a heavy hitter table.
+ * @param t the heavy hitter table to free
+ */
+void hitters_free(hitters t) {
+    sketch_free(t->counts);
+    htable_free(t->tracked);
+    free(t->scratch);
+    free(t);
+}
@@ -0,0 +1,28 @@
+#ifndef SKETCH_H_
+#define SKETCH_H_
+
+/* Header file for Count-Min sketch and heavy hitter implementation */
+typedef struct sketchrec *sketch;
+typedef struct hittersrec *hitters;
+
+extern long sketch_add(sketch s, char *str, long count);
+extern double sketch_confidence(sketch s);
+extern double sketch_error(sketch s);
+extern long sketch_estimate(sketch s, char *str);
+extern void sketch_free(sketch s);
+extern sketch sketch_new(long bytes, int depth);
+extern long sketch_size(sketch s);
+extern long sketch_total(sketch s);
+
+extern void hitters_add(hitters t, char *str);
+extern sketch hitters_counts(hitters t);
+extern long hitters_estimate(hitters t, char *str);
+extern void hitters_free(hitters t);
+extern hitters hitters_new(long budget, int k);
+extern void hitters_print(hitters t, void f(long estimate, long lower,
+                                            char *word));
+extern long hitters_size(hitters t);
+extern int hitters_tracked(hitters t);
+extern long hitters_words(hitters t);
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spill.h"
+#include "mylib.h"
+
+/* Bytes budgeted for each key: its slot and probe stats at the load the
+   table spills at, the arrays htable_print_sorted sorts it in, and a
+   typical word */
+#define SPILL_KEY_BYTES 80
+
+/* Bytes htable_print_sorted takes for each key while sorting */
+#define SPILL_SORT_BYTES 33
+
+/* Load factor the table spills at */
+#define SPILL_MAX_LOAD 0.75
+
+/* Fewest keys the table holds before spilling, however small the budget */
+#define SPILL_MIN_KEYS 1024
+
+/* Most runs merged at once, and kept open at once. Once this many are
+   waiting, the newest are merged into one */
+#define SPILL_FANIN 64
+
+/* Smallest and largest stdio buffer each run is read or written with */
+#define SPILL_MIN_BUF (64 * 1024)
+#define SPILL_MAX_BUF (4 * 1024 * 1024)
+
+/* A run being merged and the record it is up to */
+struct spill_reader {
+    FILE *file;
+    int freq;
+    char *word;
+    size_t size;
+};
+
+/* Generate spill struct. Runs are temporary files of records sorted by
+   key, each a 32-bit frequency, a 16-bit length and the key's bytes,
+   oldest first. A run's level counts the merges behind it */
+struct spillrec {
+    htable h;
+    hashing_t method;
+    hashfn_t hashfn;
+    size_t budget;
+    int capacity;
+    int num_keys;
+    FILE *runs[SPILL_FANIN];
+    int levels[SPILL_FANIN];
+    int num_runs;
+    int spilled;
+    size_t bufsize;
+    int failed;
+};
+
+/* The run spill_write is writing to, and whether a write has failed */
+static FILE *writing = NULL;
+static int write_failed = 0;
+
+/* 
+ * Create a counter that keeps its hash table within a memory budget,
+ * spilling the table to disk as a sorted run whenever it outgrows the
+ * budget and merging the runs at the end.
+ * @param budget the bytes the hash table, and the buffers of the runs
+ *  when merging, may take
+ * @param method the hashing method of the table
+ * @param hashfn the hash function of the table
+ * @return the new counter
+ */
+spill spill_new(size_t budget, hashing_t method, hashfn_t hashfn) {
+    spill s = emalloc(sizeof *s);
+    size_t keys = budget / SPILL_KEY_BYTES;
+
+    if (keys < SPILL_MIN_KEYS) {
+        keys = SPILL_MIN_KEYS;
+    }
+    s->h = NULL;
+    s->method = method;
+    s->hashfn = hashfn;
+    s->budget = budget;
+    s->capacity = next_highest_prime((int) (keys / SPILL_MAX_LOAD));
+    s->num_keys = 0;
+    s->num_runs = 0;
+    s->spilled = 0;
+    s->bufsize = budget / (SPILL_FANIN + 1);
+    s->bufsize = s->bufsize < SPILL_MIN_BUF ? SPILL_MIN_BUF
+        : s->bufsize > SPILL_MAX_BUF ? SPILL_MAX_BUF : s->bufsize;
+    s->failed = 0;
+
+    return s;
+}
+
+/* 
+ * Write a record to the run being written.
+ * @param freq the frequency of the key
+ * @param key the key, at most 65535 bytes long
+ */
+static void spill_write(int freq, char *key) {
+    int32_t f = freq;
+    uint16_t len = (uint16_t) strlen(key);
+
+    if (fwrite(&f, sizeof f, 1, writing) != 1
+            || fwrite(&len, sizeof len, 1, writing) != 1
+            || fwrite(key, 1, len, writing) != len) {
+        write_failed = 1;
+    }
+}
+
+/* 
+ * Open a new run, buffered in large blocks so that it is written and
+ * read back sequentially.
+ * @param s the counter
+ * @return the run, or NULL if no temporary file could be made
+ */
+static FILE *spill_open_run(spill s) {
+    FILE *run = tmpfile();
+
+    if (run != NULL) {
+        setvbuf(run, NULL, _IOFBF, s->bufsize);
+    }
+
+    return run;
+}
+
+/* 
+ * Read the next record of a run.
+ * @param r the reader of the run
+ * @return 1 if a record was read, 0 at the end of the run or on error
+ */
+static int spill_read(struct spill_reader *r) {
+    int32_t freq;
+    uint16_t len;
+
+    if (fread(&freq, sizeof freq, 1, r->file) != 1
+            || fread(&len, sizeof len, 1, r->file) != 1) {
+        return 0;
+    }
+    if ((size_t) len + 1 > r->size) {
+        r->size = (size_t) len + 1;
+        r->word = erealloc(r->word, r->size);
+    }
+    if (fread(r->word, 1, len, r->file) != len) {
+        return 0;
+    }
+    r->word[len] = '\0';
+    r->freq = freq;
+
+    return 1;
+}
+
+/* 
+ * Move a reader down a heap of readers until neither of its children
+ * is up to a smaller key.
+ * @param readers the readers
+ * @param heap the heap, of indexes into readers
+ * @param size the number of readers in the heap
+ * @param i the position of the reader to move
+ */
+static void spill_sift_down(struct spill_reader *readers, int *heap,
+                            int size, int i) {
+    int child, temp;
+
+    while ((child = 2 * i + 1) < size) {
+        if (child + 1 < size && strcmp(readers[heap[child + 1]].word,
+                                       readers[heap[child]].word) < 0) {
+            child++;
+        }
+        if (strcmp(readers[heap[child]].word, readers[heap[i]].word) >= 0) {
+            break;
+        }
+        temp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = temp;
+        i = child;
+    }
+}
+
+/* 
+ * Merge sorted runs into one sorted stream of keys, summing the
+ * frequencies of a key found in several runs. The runs are closed.
+ * @param runs the runs
+ * @param n the number of runs
+ * @param f the function to pass each key and its total frequency to
+ * @return 1 on success, 0 if a run couldn't be read
+ */
+static int spill_merge(FILE **runs, int n, void f(int freq, char *key)) {
+    struct spill_reader *readers = emalloc(n * sizeof readers[0]);
+    int *heap = emalloc(n * sizeof heap[0]);
+    struct spill_reader *r;
+    char *word = NULL;
+    size_t len, word_size = 0;
+    int i, freq, size = 0, ok = 1;
+
+    for (i = 0; i < n; i++) {
+        readers[i].file = runs[i];
+        readers[i].word = NULL;
+        readers[i].size = 0;
+        rewind(runs[i]);
+        if (spill_read(&readers[i])) {
+            heap[size++] = i;
+        }
+    }
+    for (i = size / 2 - 1; i >= 0; i--) {
+        spill_sift_down(readers, heap, size, i);
+    }
+
+    while (size > 0) {
+        r = &readers[heap[0]];
+        len = strlen(r->word) + 1;
+        if (len > word_size) {
+            word_size = 2 * len;
+            word = erealloc(word, word_size);
+        }
+        memcpy(word, r->word, len);
+
+        freq = 0;
+        do {
+            freq += r->freq;
+            if (!spill_read(r)) {
+                heap[0] = heap[--size];
+            }
+            spill_sift_down(readers, heap, size, 0);
+            r = &readers[heap[0]];
+        } while (size > 0 && strcmp(r->word, word) == 0);
+
+        f(freq, word);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ferror(runs[i])) {
+            ok = 0;
+        }
+        fclose(runs[i]);
+        free(readers[i].word);
+    }
+    free(readers);
+    free(heap);
+    free(word);
+
+    return ok;
+}
+
+/* 
+ * Finish writing a run and add it to the runs waiting to be merged. If
+ * that leaves as many runs as may be open at once, the newest runs of
+ * the lowest level, and at least half of all the runs, are merged into
+ * one of the next level up, so that each key is merged again only as
+ * often as the levels deepen.
+ * @param s the counter
+ * @param run the run, which is closed if it can't be finished
+ * @param level the level of the run
+ * @return 1 on success, 0 if a run couldn't be written or read
+ */
+static int spill_close_run(spill s, FILE *run, int level) {
+    int first, ok;
+
+    if (write_failed || fflush(run) != 0) {
+        fclose(run);
+        return 0;
+    }
+
+    s->runs[s->num_runs] = run;
+    s->levels[s->num_runs++] = level;
+    s->spilled++;
+    if (s->num_runs < SPILL_FANIN) {
+        return 1;
+    }
+
+    first = s->num_runs - 1;
+    while (first > 0 && s->levels[first - 1] == level) {
+        first--;
+    }
+    if (first > SPILL_FANIN / 2) {
+        first = SPILL_FANIN / 2;
+    }
+    level = s->levels[first] + 1;
+
+    run = spill_open_run(s);
+    if (run == NULL) {
+        return 0;
+    }
+    writing = run;
+    write_failed = 0;
+    ok = spill_merge(s->runs + first, s->num_runs - first, spill_write);
+    writing = NULL;
+    s->num_runs = first;
+    if (!ok) {
+        fclose(run);
+        return 0;
+    }
+
+    return spill_close_run(s, run, level);
+}
+
+/* 
+ * Write the keys of a counter's hash table to a new run in key order,
+ * with the same sort htable_print_sorted prints with, and free the
+ * table.
+ * @param s the counter
+ * @return 1 on success, 0 if the run couldn't be written
+ */
+static int spill_flush(spill s) {
+    FILE *run = spill_open_run(s);
+
+    if (run == NULL) {
+        return 0;
+    }
+
+    writing = run;
+    write_failed = 0;
+    htable_print_sorted(s->h, BY_KEY, spill_write);
+    writing = NULL;
+
+    htable_free(s->h);
+    s->h = NULL;
+    s->num_keys = 0;
+
+    return spill_close_run(s, run, 0);
+}
+
+/* 
+ * Count a key, spilling the hash table to disk first if the key would
+ * take it past its memory budget or load factor. A table always gets to
+ * hold SPILL_MIN_KEYS keys, however small the budget.
+ * @param s the counter
+ * @param str the key
+ * @return 1 on success, 0 if a run couldn't be written
+ */
+int spill_insert(spill s, char *str) {
+    if (s->failed) {
+        return 0;
+    }
+    if (s->h == NULL) {
+        s->h = htable_new(s->capacity, s->method, s->hashfn);
+    }
+
+    if (htable_insert(s->h, str) == 1
+            && (++s->num_keys >= s->capacity * SPILL_MAX_LOAD
+                || (s->num_keys >= SPILL_MIN_KEYS
+                    && htable_memory(s->h) + s->num_keys * SPILL_SORT_BYTES
+                       > s->budget))
+            && !spill_flush(s)) {
+        s->failed = 1;
+    }
+
+    return !s->failed;
+}
+
+/* 
+ * Print every key a counter has counted with its frequency, in key
+ * order. If nothing was spilled the table is printed straight from
+ * memory, otherwise the table is spilled too and the runs are merged.
+ * @param s the counter, which can't be added to afterwards
+ * @param f the function to print each key with
+ * @return 1 on success, 0 if a run couldn't be written or read
+ */
+int spill_print(spill s, void f(int freq, char *key)) {
+    int ok;
+
+    if (s->failed) {
+        return 0;
+    }
+    if (s->num_runs == 0) {
+        if (s->h != NULL) {
+            htable_print_sorted(s->h, BY_KEY, f);
+        }
+        return 1;
+    }
+    if (s->h != NULL && !spill_flush(s)) {
+        return 0;
+    }
+
+    ok = spill_merge(s->runs, s->num_runs, f);
+    s->num_runs = 0;
+
+    return ok;
+}
+
+/* 
+ * Number of runs a counter has written.
+ * @param s the counter
+ * @return the number of runs, counting those written by merge passes
+ */
+int spill_runs(spill s) {
+    return s->spilled;
+}
+
+/* 
+ * Free a counter, closing and so deleting any runs it still has.
+ * @param s the counter to free
+ */
+void spill_free(spill s) {
+    int i;
+
+    if (s->h != NULL) {
+        htable_free(s->h);
+    }
+    for (i = 0; i < s->num_runs; i++) {
+        fclose(s->runs[i]);
+    }
+    free(s);
+}
@@ -0,0 +1,16 @@
+#ifndef SPILL_H_
+#define SPILL_H_
+
+#include <stddef.h>
+#include "htable.h"
+
+/* Header file for external memory counting implementation */
+typedef struct spillrec *spill;
+
+extern void spill_free(spill s);
+extern int spill_insert(spill s, char *str);
+extern spill spill_new(size_t budget, hashing_t method, hashfn_t hashfn);
+extern int spill_print(spill s, void f(int freq, char *key));
+extern int spill_runs(spill s);
+
+#endif
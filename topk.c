@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topk.h"
+#include "mylib.h"
+
+/* Entries the heap starts with room for, it grows from there up to k */
+#define TOPK_INITIAL 1024
+
+/* A word offered to the heap. The word is not copied */
+struct topk_entry {
+    int freq;
+    char *word;
+};
+
+/* Generate top-k struct, a min-heap of the heaviest words seen so far
+   with the lightest of them at heap[0] */
+struct topkrec {
+    struct topk_entry *heap;
+    int size;
+    int capacity;
+    int k;
+};
+
+/* 
+ * Order two entries by weight. Ties in frequency go to the word that
+ * sorts first, so the words kept don't depend on the order they came in.
+ * @param a an entry
+ * @param b another entry
+ * @return 1 if a is lighter than b, 0 otherwise
+ */
+static int topk_lighter(struct topk_entry *a, struct topk_entry *b) {
+    return a->freq < b->freq
+        || (a->freq == b->freq && strcmp(a->word, b->word) > 0);
+}
+
+/* 
+ * Move an entry down a heap until neither of its children is lighter.
+ * @param heap the heap
+ * @param size the number of entries in the heap
+ * @param i the position of the entry to move
+ */
+static void topk_sift_down(struct topk_entry *heap, int size, int i) {
+    struct topk_entry temp;
+    int child;
+
+    while ((child = 2 * i + 1) < size) {
+        if (child + 1 < size && topk_lighter(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!topk_lighter(&heap[child], &heap[i])) {
+            break;
+        }
+        temp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = temp;
+        i = child;
+    }
+}
+
+/* 
+ * Create an empty top-k heap. Room for the words is added as they come,
+ * so a large k costs nothing until that many words are offered.
+ * @param k the number of heaviest words to keep, at least 1
+ * @return the new heap
+ */
+topk topk_new(int k) {
+    topk t = emalloc(sizeof *t);
+
+    t->k = k > 0 ? k : 1;
+    t->size = 0;
+    t->capacity = t->k < TOPK_INITIAL ? t->k : TOPK_INITIAL;
+    t->heap = emalloc(t->capacity * sizeof t->heap[0]);
+
+    return t;
+}
+
+/* 
+ * Offer a word to a top-k heap. Until the heap is full the word is
+ * added, after that it only replaces the lightest word kept if it is
+ * heavier, so each offer takes O(log k) time at most.
+ * @param t the heap
+ * @param freq the frequency of the word
+ * @param word the word, which must outlive the heap
+ */
+void topk_add(topk t, int freq, char *word) {
+    struct topk_entry entry, temp;
+    int i, parent;
+
+    entry.freq = freq;
+    entry.word = word;
+
+    if (t->size < t->k) {
+        if (t->size == t->capacity) {
+            t->capacity = t->capacity > t->k / 2 ? t->k : 2 * t->capacity;
+            t->heap = erealloc(t->heap, t->capacity * sizeof t->heap[0]);
+        }
+        i = t->size++;
+        t->heap[i] = entry;
+        while (i > 0) {
+            parent = (i - 1) / 2;
+            if (!topk_lighter(&t->heap[i], &t->heap[parent])) {
+                break;
+            }
+            temp = t->heap[i];
+            t->heap[i] = t->heap[parent];
+            t->heap[parent] = temp;
+            i = parent;
+        }
+    } else if (topk_lighter(&t->heap[0], &entry)) {
+        t->heap[0] = entry;
+        topk_sift_down(t->heap, t->size, 0);
+    }
+}
+
+/* 
+ * Print the words kept by a top-k heap, heaviest first. The heap is
+ * sorted in place, so it must not be added to afterwards.
+ * @param t the heap
+ * @param f the function to print each word with
+ */
+void topk_print(topk t, void f(int freq, char *word)) {
+    struct topk_entry temp;
+    int i;
+
+    /* heapsort, moving the lightest entry to the back each time */
+    for (i = t->size - 1; i > 0; i--) {
+        temp = t->heap[0];
+        t->heap[0] = t->heap[i];
+        t->heap[i] = temp;
+        topk_sift_down(t->heap, i, 0);
+    }
+
+    for (i = 0; i < t->size; i++) {
+        f(t->heap[i].freq, t->heap[i].word);
+    }
+}
+
+/* 
+ * Free a top-k heap, leaving the words it was given alone.
+ * @param t the heap to free
+ */
+void topk_free(topk t) {
+    free(t->heap);
+    free(t);
+}
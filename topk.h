@@ -0,0 +1,12 @@
+#ifndef TOPK_H_
+#define TOPK_H_
+
+/* Header file for top-k heap implementation */
+typedef struct topkrec *topk;
+
+extern void topk_add(topk t, int freq, char *word);
+extern void topk_free(topk t);
+extern topk topk_new(int k);
+extern void topk_print(topk t, void f(int freq, char *word));
+
+#endif
@@ -1,135 +1,497 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "tree.h"
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include "mylib.h"
 
-#define IS_BLACK(x) ((NULL == (x)) || (BLACK == (x)->colour))
-#define IS_RED(x) ((NULL != (x)) && (RED == (x)->colour))
+/* Bytes in one slab of nodes, slabs are aligned to their size */
+#define TREE_SLAB_SIZE 65536
+
+/* Nodes per slab, leaving room for the slab header */
+#define TREE_SLAB_NODES \
+    ((TREE_SLAB_SIZE - sizeof(struct tree_node)) / sizeof(struct tree_node))
+
+/* The node at an index of a pool */
+#define NODE(p, i) \
+    (&(p)->slabs[(i) / TREE_SLAB_NODES]->nodes[(i) % TREE_SLAB_NODES])
+
+#define IS_BLACK(p, i) ((0 == (i)) || (BLACK == NODE(p, i)->colour))
+#define IS_RED(p, i) ((0 != (i)) && (RED == NODE(p, i)->colour))
+
+/* Bytes of each key held inline by a frozen tree */
+#define FROZEN_PREFIX 8
+
+/* Hint that a cache line will be read soon */
+#ifdef __GNUC__
+#define TREE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define TREE_PREFETCH(p) ((void) 0)
+#endif
 
-static tree_t tree_type;
+/* Run a counter update only in builds made with -DINSTRUMENT, so the
+   counters cost nothing otherwise */
+#ifdef INSTRUMENT
+#define TREE_COUNT(stmt) (stmt)
+#else
+#define TREE_COUNT(stmt) ((void) 0)
+#endif
 
-/* Generate tree struct */
+/* Nodes are named by their index in the pool, 0 stands for no node */
+typedef unsigned int tree_index;
+
+/* A growable stack of node indices for the iterative traversals */
+struct tree_stack {
+    tree_index *items;
+    int size;
+    int capacity;
+};
+
+/* Generate tree struct, child[0] is the left child and child[1] the right */
 struct tree_node {
     char *key;
-    tree_colour colour;
-    tree left;
-    tree right;
+    tree_index child[2];
     int frequency;
+    unsigned char colour;
+};
+
+/* Identifies frozen tree snapshot files, and the layout they use */
+#define FROZEN_MAGIC "TREESNAP"
+#define FROZEN_VERSION 1
+
+/* Written in native byte order, to spot files from other machines */
+#define FROZEN_BYTE_ORDER 0x01020304u
+
+/* A node of a frozen tree: the first bytes of the key packed big-endian,
+   so comparing prefixes as integers orders them like strcmp, and the
+   offset of the whole key in the key block */
+struct frozen_node {
+    uint64_t prefix;
+    uint64_t key;
+};
+
+/* Generate frozen tree struct, the nodes are in Eytzinger order from
+   nodes[1], and the keys are packed in sorted order in one block. Both
+   live in the snapshot file when the tree was loaded from one */
+struct frozenrec {
+    struct frozen_node *nodes;
+    char *keys;
+    int size;
+    size_t keys_size;
+    void *map;
+    size_t map_size;
+};
+
+/* The head of a frozen tree snapshot. Offsets count from the start of
+   the file */
+struct frozen_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;
+    uint64_t nodes_offset;
+    uint64_t keys_offset;
+    uint64_t keys_size;
+};
+
+/* Everything a tree owns, shared by all its nodes and released by
+   tree_free, so that separate trees can be built at the same time. Slabs
+   never move once allocated, so node pointers stay valid as the pool
+   grows. Keys live in one arena, which tracks the bytes held by keys
+   still in the tree and by deleted ones */
+struct tree_pool {
+    tree_t type;
+    struct tree_slab **slabs;
+    int num_slabs;
+    int max_slabs;
+    tree_index num_nodes;
+    tree_index free_nodes; /* freed by deletes, linked through child[0] */
+    arena keys;
+    size_t live_bytes;
+    size_t dead_bytes;
+#ifdef INSTRUMENT
+    struct tree_counters counts; /* and the depth of the search underway */
+    int depth;
+#endif
+};
+
+/* A block of nodes, numbered on from the index of its first node, and
+   the pool it belongs to */
+struct tree_slab {
+    struct tree_pool *pool;
+    tree_index first;
+    struct tree_node nodes[TREE_SLAB_NODES];
 };
 
+#ifdef INSTRUMENT
+/* Frozen trees may be loaded rather than frozen from a tree, so their
+   searches are counted here and added to the counts of every tree */
+static struct tree_counters frozen_counts;
+static int frozen_depth = 0;
+
 /* 
- * Rotate the nodes of a tree to the left.
- * @param b a given tree to rotate
- * @return the updated tree
+ * Count the outcome of a search and the depth it reached, then start
+ * the depth again for the next search.
+ * @param c the counts to add to
+ * @param depth the depth the search reached, set back to 0
+ * @param found whether the key was found
  */
-static tree left_rotate(tree b) {    
-    tree root, temp;
+static void tree_count_search(struct tree_counters *c, int *depth,
+                              int found) {
+    int bucket = *depth < TREE_DEPTH_BUCKETS
+        ? *depth : TREE_DEPTH_BUCKETS - 1;
 
-    root = b;
-    temp = root;
+    if (found) {
+        c->hits++;
+        c->hit_depths[bucket]++;
+    } else {
+        c->misses++;
+        c->miss_depths[bucket]++;
+    }
+    *depth = 0;
+}
+#endif
 
-    root = b->right;
-    temp->right = root->left;
+/* 
+ * Find the slab a node lives in by aligning its address down.
+ * @param b a node of a tree
+ * @return the slab holding the node
+ */
+static struct tree_slab *tree_slab_of(tree b) {
+    return (struct tree_slab *) ((uintptr_t) b
+                                 & ~(uintptr_t) (TREE_SLAB_SIZE - 1));
+}
 
-    root->left = temp;
+/* 
+ * Find the pool a node belongs to, from the header of its slab.
+ * @param b a node of a tree
+ * @return the pool of the tree
+ */
+static struct tree_pool *tree_pool_of(tree b) {
+    return tree_slab_of(b)->pool;
+}
 
-    return root;
+/* 
+ * Find the pool index of a node from its address, using the header of
+ * the aligned slab it lives in.
+ * @param b a node of the tree, or NULL
+ * @return the index of the node, 0 for NULL
+ */
+static tree_index tree_index_of(tree b) {
+    struct tree_slab *slab;
+
+    if (b == NULL) {
+        return 0;
+    }
+    slab = tree_slab_of(b);
+
+    return slab->first + (tree_index) (b - slab->nodes);
+}
+
+/* 
+ * Find a node from its pool index.
+ * @param p the pool
+ * @param i the index of a node, or 0
+ * @return the node, NULL for 0
+ */
+static tree tree_at(struct tree_pool *p, tree_index i) {
+    return i == 0 ? NULL : NODE(p, i);
 }
 
 /* 
- * Rotate the nodes of a tree to the right.
- * @param b a given tree to rotate
- * @return the updated tree
+ * Take an unused node from the pool, reusing a deleted node if there is
+ * one and adding a slab when the last one is full. Index 0 is never
+ * handed out.
+ * @param p the pool
+ * @return the index of the node
  */
-static tree right_rotate(tree b) {
-    tree root, temp;
+static tree_index tree_alloc(struct tree_pool *p) {
+    struct tree_slab *slab;
+    tree_index i = p->free_nodes;
 
-    root = b;
-    temp = root;
+    if (i != 0) {
+        p->free_nodes = NODE(p, i)->child[0];
+        return i;
+    }
 
-    root = b->left;
-    temp->left = root->right;
+    if (p->num_nodes == p->num_slabs * TREE_SLAB_NODES) {
+        if (p->num_slabs == p->max_slabs) {
+            p->max_slabs = p->max_slabs == 0 ? 16 : 2 * p->max_slabs;
+            p->slabs = erealloc(p->slabs, p->max_slabs * sizeof p->slabs[0]);
+        }
+        if (posix_memalign((void **) &slab, TREE_SLAB_SIZE, sizeof *slab)) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
+        }
+        slab->pool = p;
+        slab->first = p->num_nodes;
+        p->slabs[p->num_slabs++] = slab;
 
-    root->right = temp;
+        if (p->num_nodes == 0) {
+            p->num_nodes = 1;
+        }
+    }
 
-    return root;
+    return p->num_nodes++;
+}
+
+/* 
+ * Return a node to the pool for tree_alloc to hand out again.
+ * @param p the pool
+ * @param i the index of the node
+ */
+static void tree_release(struct tree_pool *p, tree_index i) {
+    tree b = NODE(p, i);
+
+    b->key = NULL;
+    b->child[0] = p->free_nodes;
+    b->child[1] = 0;
+    p->free_nodes = i;
+}
+
+/* 
+ * Push a node index onto a traversal stack, growing it when full.
+ * @param s the stack
+ * @param i the index to push
+ */
+static void stack_push(struct tree_stack *s, tree_index i) {
+    if (s->size == s->capacity) {
+        s->capacity = s->capacity == 0 ? 64 : 2 * s->capacity;
+        s->items = erealloc(s->items, s->capacity * sizeof s->items[0]);
+    }
+    s->items[s->size++] = i;
+}
+
+/* 
+ * Pop the top node index off a traversal stack.
+ * @param s a stack that is not empty
+ * @return the index popped
+ */
+static tree_index stack_pop(struct tree_stack *s) {
+    return s->items[--s->size];
+}
+
+/* 
+ * Rotate a subtree, lifting the child on one side into its place. The
+ * old root becomes red and the new one black, as top-down insertion
+ * needs.
+ * @param p the pool
+ * @param root the root of the subtree
+ * @param dir the side the old root moves to, 0 to rotate right and 1
+ *  to rotate left
+ * @return the new root of the subtree
+ */
+static tree_index tree_rotate(struct tree_pool *p, tree_index root,
+                              int dir) {
+    tree b = NODE(p, root);
+    tree_index save = b->child[!dir];
+    tree s = NODE(p, save);
+
+    b->child[!dir] = s->child[dir];
+    s->child[dir] = root;
+    b->colour = RED;
+    s->colour = BLACK;
+    TREE_COUNT(p->counts.rotations++);
+
+    return save;
+}
+
+/* 
+ * Rotate a subtree twice, lifting a grandchild into its place.
+ * @param p the pool
+ * @param root the root of the subtree
+ * @param dir the side the old root moves to
+ * @return the new root of the subtree
+ */
+static tree_index tree_rotate_double(struct tree_pool *p, tree_index root,
+                                     int dir) {
+    tree b = NODE(p, root);
+
+    b->child[!dir] = tree_rotate(p, b->child[!dir], !dir);
+
+    return tree_rotate(p, root, dir);
+}
+
+/* 
+ * Create an empty node in the pool.
+ * @param p the pool
+ * @return the index of the node
+ */
+static tree_index tree_new_node(struct tree_pool *p) {
+    tree_index i = tree_alloc(p);
+    tree b = NODE(p, i);
+
+    b->key = NULL;
+    b->child[0] = 0;
+    b->child[1] = 0;
+    b->colour = RED;
+    b->frequency = 0;
+
+    return i;
+}
+
+/* 
+ * Give a node its key, copied into the tree's arena. The frequency is
+ * left for the caller to count.
+ * @param p the pool
+ * @param b the node
+ * @param str the key
+ */
+static void tree_set_key(struct tree_pool *p, tree b, char *str) {
+    if (p->keys == NULL) {
+        p->keys = arena_new();
+    }
+    b->key = arena_strdup(p->keys, str);
+    p->live_bytes += strlen(str) + 1;
 }
 
 /*
- * Create a new tree.
+ * Create a new tree. The tree starts as a single node with no key, and
+ * keeps its own pool of nodes and keys.
  * @param type used to define what tree the program creates
  * @return the newly created tree with a user-defined type
  */
 tree tree_new(tree_t type) {
-    tree b = emalloc(sizeof(struct tree_node));
-    b->key = NULL;
-    b->left = NULL;
-    b->right = NULL;
-    tree_type = type;
+    struct tree_pool *p = emalloc(sizeof *p);
 
-    b->colour = RED;
-    b->frequency = 0;
-    
-    return b;
+    memset(p, 0, sizeof *p);
+    p->type = type;
+
+    return tree_at(p, tree_new_node(p));
 }
 
 /* 
- * Fix trees when their structure is altered.
- * @param b a given tree requiring restructuring
- * @return the post-fix tree
+ * Insert a value into a binary search tree, walking down from the root
+ * and hanging a new node off the link where the search ends.
+ * @param p the pool
+ * @param root the index of the root
+ * @param str the value to be inserted into the tree
+ * @param count the number of times to count the value
+ * @return the index of the root
  */
-tree tree_fix(tree b){
-    if(IS_RED(b->left) && IS_RED(b->left->left)){
-        if (IS_RED(b->right)){
-            b->colour = RED;
-            b->left->colour = BLACK;
-            b->right->colour = BLACK;
-        }else{
-            b = right_rotate(b);
-            b->colour = BLACK;
-            b->right->colour = RED;
+static tree_index tree_insert_bst(struct tree_pool *p, tree_index root,
+                                  char *str, int count) {
+    tree_index *link = &root;
+    tree b;
+    int cmp;
+
+    while (*link != 0) {
+        b = NODE(p, *link);
+        cmp = strcmp(str, b->key);
+        TREE_COUNT(p->counts.strcmps++);
+        if (cmp < 0) {
+            link = &b->child[0];
+        } else if (cmp > 0) {
+            link = &b->child[1];
+        } else {
+            b->frequency += count;
+            return root;
         }
     }
 
-    else if(IS_RED(b->left) && IS_RED(b->left->right)){
-        if (IS_RED(b->right)){
-            b->colour = RED;
-            b->left->colour = BLACK;
-            b->right->colour = BLACK;
-        }else{
-            b->left = left_rotate(b->left);
-            b = right_rotate(b);
-            b->colour = BLACK;
-            b->right->colour = RED;
+    *link = tree_new_node(p);
+    tree_set_key(p, NODE(p, *link), str);
+    NODE(p, *link)->frequency = count;
+
+    return root;
+}
+
+/* 
+ * Insert a value into a red-black tree in a single pass down from the
+ * root. Any node with two red children on the way down is flipped to
+ * red with black children, and a red node with a red parent is repaired
+ * at once by rotating at its grandparent, so nothing needs fixing on
+ * the way back up.
+ * @param p the pool
+ * @param root the index of the root
+ * @param str the value to be inserted into the tree
+ * @param count the number of times to count the value
+ * @return the index of the new root
+ */
+static tree_index tree_insert_rbt(struct tree_pool *p, tree_index root,
+                                  char *str, int count) {
+    tree_index great = 0, grand = 0, parent = 0, q = root;
+    tree_index *up;
+    int dir = 0, last = 0, cmp;
+    tree b;
+
+    for (;;) {
+        if (q == 0) {
+            q = tree_new_node(p);
+            tree_set_key(p, NODE(p, q), str);
+            NODE(p, parent)->child[dir] = q;
+            cmp = 0;
+        } else {
+            b = NODE(p, q);
+            if (IS_RED(p, b->child[0]) && IS_RED(p, b->child[1])) {
+                b->colour = RED;
+                NODE(p, b->child[0])->colour = BLACK;
+                NODE(p, b->child[1])->colour = BLACK;
+                TREE_COUNT(p->counts.recolours++);
+            }
+            cmp = strcmp(str, b->key);
+            TREE_COUNT(p->counts.strcmps++);
         }
-    }
 
-    else if(IS_RED(b->right) && IS_RED(b->right->left)){
-        if (IS_RED(b->left)){
-            b->colour = RED;
-            b->left->colour = BLACK;
-            b->right->colour = BLACK;
-        }else{
-            b->right = right_rotate(b->right);
-            b = left_rotate(b);
-            b->colour = BLACK;
-            b->right->colour= RED;
+        if (IS_RED(p, q) && IS_RED(p, parent)) {
+            b = NODE(p, great);
+            up = great == 0 ? &root : &b->child[b->child[1] == grand];
+            if (q == NODE(p, parent)->child[last]) {
+                *up = tree_rotate(p, grand, !last);
+            } else {
+                *up = tree_rotate_double(p, grand, !last);
+            }
+        }
+
+        if (cmp == 0) {
+            NODE(p, q)->frequency += count;
+            break;
         }
-    }
 
-    else if (IS_RED(b->right) && IS_RED(b->right->right)){
-        if (IS_RED(b->left)){
-            b->colour = RED;
-            b->left->colour = BLACK;
-            b->right->colour = BLACK;
-        }else{
-            b = left_rotate(b);
-            b->colour = BLACK;
-            b->left->colour = RED;
+        last = dir;
+        if (grand != 0) {
+            great = grand;
+        }
+        grand = parent;
+        parent = q;
+        if (cmp < 0) {
+            dir = 0;
+            q = NODE(p, q)->child[0];
+        } else {
+            dir = 1;
+            q = NODE(p, q)->child[1];
         }
     }
 
-    return b;
+    return root;
+}
+
+/* 
+ * Count a value some number of times in a given tree, inserting it if
+ * it is not there yet.
+ * @param b the tree
+ * @param str the value to be counted
+ * @param count the number of times to count it
+ * @return the tree, whose root may have changed
+ */
+static tree tree_add(tree b, char *str, int count) {
+    struct tree_pool *p = tree_pool_of(b);
+    tree_index root = tree_index_of(b);
+
+    if (b->key == NULL) {
+        tree_set_key(p, b, str);
+        b->frequency = count;
+        return b;
+    }
+
+    if (p->type == RBT) {
+        root = tree_insert_rbt(p, root, str, count);
+    } else {
+        root = tree_insert_bst(p, root, str, count);
+    }
+
+    return NODE(p, root);
 }
 
 /* 
@@ -138,32 +500,226 @@ tree tree_fix(tree b){
  * @param str the value to be inserted into the tree
  */
 tree tree_insert(tree b, char *str) {
+    TREE_COUNT(tree_pool_of(b)->counts.inserts++);
+
+    return tree_add(b, str, 1);
+}
+
+/* 
+ * Count the key of a node as deleted.
+ * @param p the pool
+ * @param b the node whose key is going
+ */
+static void tree_drop_key(struct tree_pool *p, tree b) {
+    size_t len = strlen(b->key) + 1;
+
+    p->live_bytes -= len;
+    p->dead_bytes += len;
+}
+
+/* 
+ * Copy the keys of a tree into a new arena, leaving behind the bytes of
+ * deleted keys.
+ * @param p the pool
+ * @param root the index of the root
+ */
+static void tree_compact_keys(struct tree_pool *p, tree_index root) {
+    struct tree_stack stack = {NULL, 0, 0};
+    arena old = p->keys;
+    tree_index i;
+    tree b;
+
+    p->keys = arena_new();
+    if (root != 0) {
+        stack_push(&stack, root);
+    }
+    while (stack.size > 0) {
+        i = stack_pop(&stack);
+        b = NODE(p, i);
+        b->key = arena_strdup(p->keys, b->key);
+        if (b->child[0] != 0) {
+            stack_push(&stack, b->child[0]);
+        }
+        if (b->child[1] != 0) {
+            stack_push(&stack, b->child[1]);
+        }
+    }
+    free(stack.items);
+    p->dead_bytes = 0;
+
+    arena_free(old);
+}
+
+/* 
+ * Delete a value from a binary search tree. A node with two children
+ * takes the key of its in-order successor, which is unlinked instead.
+ * @param p the pool
+ * @param root the index of the root
+ * @param str the value to be deleted
+ * @return the index of the root, 0 if the tree is now empty
+ */
+static tree_index tree_delete_bst(struct tree_pool *p, tree_index root,
+                                  char *str) {
+    tree_index *link = &root, *next;
+    tree_index q;
+    tree b;
     int cmp;
-    if (b == NULL) {
-        b = tree_new(tree_type);
+
+    while (*link != 0) {
+        b = NODE(p, *link);
+        cmp = strcmp(str, b->key);
+        TREE_COUNT(p->counts.strcmps++);
+        if (cmp < 0) {
+            link = &b->child[0];
+        } else if (cmp > 0) {
+            link = &b->child[1];
+        } else {
+            break;
+        }
     }
-    
-    if (b->key == NULL) {
-        b->key = emalloc(sizeof(char) * (strlen(str) + 1));
-        strcpy(b->key, str);
-        b->frequency = 1;
+    if (*link == 0) {
+        return root;
+    }
+
+    q = *link;
+    b = NODE(p, q);
+    tree_drop_key(p, b);
+
+    if (b->child[0] != 0 && b->child[1] != 0) {
+        next = &b->child[1];
+        while (NODE(p, *next)->child[0] != 0) {
+            next = &NODE(p, *next)->child[0];
+        }
+        q = *next;
+        b->key = NODE(p, q)->key;
+        b->frequency = NODE(p, q)->frequency;
+        *next = NODE(p, q)->child[1];
+    } else {
+        *link = b->child[b->child[0] == 0];
+    }
+    tree_release(p, q);
+
+    return root;
+}
+
+/* 
+ * Delete a value from a red-black tree in a single pass down from the
+ * root, the counterpart of tree_insert_rbt. The node the search stands
+ * on is kept red on the way down, by rotating a red child up or by
+ * borrowing colour from its sibling, so the node finally unlinked, the
+ * value's in-order predecessor or the value itself, is always red and
+ * can go without any repair. The unused node 0 of the pool serves as
+ * the parent of the root while the pass runs.
+ * @param p the pool
+ * @param root the index of the root
+ * @param str the value to be deleted
+ * @return the index of the new root, 0 if the tree is now empty
+ */
+static tree_index tree_delete_rbt(struct tree_pool *p, tree_index root,
+                                  char *str) {
+    tree_index head = 0, grand = 0, parent = 0, q = head, found = 0, s, t;
+    int dir = 1, last, side, cmp;
+
+    NODE(p, head)->child[0] = 0;
+    NODE(p, head)->child[1] = root;
+
+    while (NODE(p, q)->child[dir] != 0) {
+        last = dir;
+        grand = parent;
+        parent = q;
+        q = NODE(p, q)->child[dir];
+        cmp = strcmp(str, NODE(p, q)->key);
+        TREE_COUNT(p->counts.strcmps++);
+        dir = cmp > 0;
+        if (cmp == 0) {
+            found = q;
+        }
+
+        if (IS_RED(p, q) || IS_RED(p, NODE(p, q)->child[dir])) {
+            continue;
+        }
+        if (IS_RED(p, NODE(p, q)->child[!dir])) {
+            parent = NODE(p, parent)->child[last] = tree_rotate(p, q, dir);
+            continue;
+        }
+
+        s = NODE(p, parent)->child[!last];
+        if (s == 0) {
+            continue;
+        }
+        if (IS_BLACK(p, NODE(p, s)->child[0])
+                && IS_BLACK(p, NODE(p, s)->child[1])) {
+            NODE(p, parent)->colour = BLACK;
+            NODE(p, s)->colour = RED;
+            NODE(p, q)->colour = RED;
+            TREE_COUNT(p->counts.recolours++);
+        } else {
+            side = NODE(p, grand)->child[1] == parent;
+            if (IS_RED(p, NODE(p, s)->child[last])) {
+                t = tree_rotate_double(p, parent, last);
+            } else {
+                t = tree_rotate(p, parent, last);
+            }
+            NODE(p, grand)->child[side] = t;
+            NODE(p, q)->colour = RED;
+            NODE(p, t)->colour = RED;
+            NODE(p, NODE(p, t)->child[0])->colour = BLACK;
+            NODE(p, NODE(p, t)->child[1])->colour = BLACK;
+            TREE_COUNT(p->counts.recolours++);
+        }
+    }
+
+    if (found != 0) {
+        tree_drop_key(p, NODE(p, found));
+        NODE(p, found)->key = NODE(p, q)->key;
+        NODE(p, found)->frequency = NODE(p, q)->frequency;
+        NODE(p, parent)->child[NODE(p, parent)->child[1] == q]
+            = NODE(p, q)->child[NODE(p, q)->child[0] == 0];
+        tree_release(p, q);
+    }
+
+    root = NODE(p, head)->child[1];
+    NODE(p, head)->child[1] = 0;
+    if (root != 0) {
+        NODE(p, root)->colour = BLACK;
+    }
+
+    return root;
+}
+
+/* 
+ * Delete a value from a given tree, whatever its frequency. Once the
+ * keys of deleted values take up more of the tree's arena than live
+ * ones, the live keys are copied to a new arena.
+ * @param b a given tree to delete a value from
+ * @param str the value to be deleted
+ * @return the tree, which is a single node with no key once its last
+ *  value is deleted
+ */
+tree tree_delete(tree b, char *str) {
+    struct tree_pool *p;
+    tree_index root = tree_index_of(b);
+
+    if (root == 0 || b->key == NULL) {
         return b;
     }
-    
-    cmp = strcmp(str, b->key);
-    if (cmp < 0) {
-        b->left = tree_insert(b->left, str);
-    } else if (cmp > 0) {
-        b->right = tree_insert(b->right, str);
-    } else if (cmp == 0) {
-        b->frequency += 1;
+    p = tree_pool_of(b);
+    TREE_COUNT(p->counts.deletes++);
+
+    if (p->type == RBT) {
+        root = tree_delete_rbt(p, root, str);
+    } else {
+        root = tree_delete_bst(p, root, str);
     }
-    
-    if (tree_type == RBT) {
-        b = tree_fix(b);
+
+    if (p->dead_bytes > p->live_bytes) {
+        tree_compact_keys(p, root);
     }
-    
-    return b;
+    if (root == 0) { /* keep a node so the tree keeps its pool */
+        root = tree_new_node(p);
+    }
+
+    return NODE(p, root);
 }
 
 /*
@@ -173,16 +729,49 @@ tree tree_insert(tree b, char *str) {
  * @param str the value to search the tree for
  */
 int tree_search(tree b, char *str) {
+    struct tree_pool *p;
+    tree_index i = tree_index_of(b);
+    int cmp;
+
     if (b == NULL) {
         return 0;
     }
-    if (strcmp(str, b->key) == 0) {
-        return 1;
-    } else if (strcmp(str, b->key) < 0) {
-        return tree_search(b->left, str);
-    } else {
-        return tree_search(b->right, str);
+    p = tree_pool_of(b);
+    if (b->key == NULL) {
+        TREE_COUNT(tree_count_search(&p->counts, &p->depth, 0));
+        return 0;
     }
+
+    while (i != 0) {
+        b = NODE(p, i);
+        cmp = strcmp(str, b->key);
+        TREE_COUNT((p->counts.strcmps++, p->depth++));
+        if (cmp < 0) {
+            i = b->child[0];
+        } else if (cmp > 0) {
+            i = b->child[1];
+        } else {
+            TREE_COUNT(tree_count_search(&p->counts, &p->depth, 1));
+            return 1;
+        }
+    }
+
+    TREE_COUNT(tree_count_search(&p->counts, &p->depth, 0));
+    return 0;
+}
+
+/* 
+ * Bytes the tree takes: its slabs of nodes, whether in use or not, and
+ * the keys in its arena, counting those of deleted nodes not yet
+ * compacted away.
+ * @param b the tree
+ * @return the bytes
+ */
+size_t tree_memory(tree b) {
+    struct tree_pool *p = tree_pool_of(b);
+
+    return p->num_slabs * sizeof(struct tree_slab)
+        + p->live_bytes + p->dead_bytes;
 }
 
 /* 
@@ -191,12 +780,26 @@ int tree_search(tree b, char *str) {
  * @param f a function given a value to traverse
  */
 void tree_inorder(tree b, void f(char *str)) {
-    if (b == NULL) {
+    struct tree_stack stack = {NULL, 0, 0};
+    tree_index i = tree_index_of(b);
+    struct tree_pool *p;
+
+    if (i == 0 || b->key == NULL) {
         return;
     }
-    tree_inorder(b->left, f);
-    f(b->key);
-    tree_inorder(b->right, f);
+    p = tree_pool_of(b);
+
+    while (i != 0 || stack.size > 0) {
+        while (i != 0) {
+            stack_push(&stack, i);
+            i = NODE(p, i)->child[0];
+        }
+        i = stack_pop(&stack);
+        f(NODE(p, i)->key);
+        i = NODE(p, i)->child[1];
+    }
+
+    free(stack.items);
 }
 /* 
  * Traverse a tree in pre-order fashion.
@@ -204,12 +807,339 @@ void tree_inorder(tree b, void f(char *str)) {
  * @param f a function given a word frequency value aswell as a key value to traverse
  */
 void tree_preorder(tree b, void f(int frequency, char *str)) {
-    if (b == NULL) {
+    struct tree_stack stack = {NULL, 0, 0};
+    tree_index i = tree_index_of(b);
+    struct tree_pool *p;
+
+    if (i == 0 || b->key == NULL) {
         return;
     }
-    f(b->frequency, b->key);
-    tree_preorder(b->left, f);
-    tree_preorder(b->right, f);
+    p = tree_pool_of(b);
+    stack_push(&stack, i);
+    while (stack.size > 0) {
+        i = stack_pop(&stack);
+        b = NODE(p, i);
+        f(b->frequency, b->key);
+        if (b->child[1] != 0) {
+            stack_push(&stack, b->child[1]);
+        }
+        if (b->child[0] != 0) {
+            stack_push(&stack, b->child[0]);
+        }
+    }
+
+    free(stack.items);
+}
+
+#ifdef INSTRUMENT
+/* 
+ * Add one set of operation counts to another.
+ * @param to the counts to add to
+ * @param from the counts to add
+ */
+static void tree_add_counts(struct tree_counters *to,
+                            struct tree_counters *from) {
+    int i;
+
+    to->inserts += from->inserts;
+    to->deletes += from->deletes;
+    to->hits += from->hits;
+    to->misses += from->misses;
+    to->strcmps += from->strcmps;
+    to->rotations += from->rotations;
+    to->recolours += from->recolours;
+    for (i = 0; i < TREE_DEPTH_BUCKETS; i++) {
+        to->hit_depths[i] += from->hit_depths[i];
+        to->miss_depths[i] += from->miss_depths[i];
+        to->node_depths[i] += from->node_depths[i];
+    }
+}
+#endif
+
+/* 
+ * Add every key of one tree to another, summing the frequencies of keys
+ * found in both. The source tree is walked in pre-order, so a source
+ * that is balanced is not fed to the other in sorted order. The source
+ * tree is left unchanged.
+ * @param b the tree to merge into
+ * @param src the tree to merge from
+ * @return the tree merged into, whose root may have changed
+ */
+tree tree_merge(tree b, tree src) {
+    struct tree_stack stack = {NULL, 0, 0};
+    tree_index i = tree_index_of(src);
+    struct tree_pool *p;
+    tree n;
+
+    if (i == 0 || src->key == NULL) {
+        return b;
+    }
+    p = tree_pool_of(src);
+    TREE_COUNT(tree_add_counts(&tree_pool_of(b)->counts, &p->counts));
+
+    stack_push(&stack, i);
+    while (stack.size > 0) {
+        i = stack_pop(&stack);
+        n = NODE(p, i);
+        b = tree_add(b, n->key, n->frequency);
+        b->colour = BLACK; /* as a red-black root must be */
+        if (n->child[1] != 0) {
+            stack_push(&stack, n->child[1]);
+        }
+        if (n->child[0] != 0) {
+            stack_push(&stack, n->child[0]);
+        }
+    }
+
+    free(stack.items);
+    return b;
+}
+
+/* 
+ * Pack the first bytes of a string big-endian into an integer, padding
+ * short strings with zeros.
+ * @param str the string
+ * @return the packed prefix
+ */
+static uint64_t frozen_prefix(char *str) {
+    uint64_t out = 0;
+    int i;
+
+    for (i = 0; i < FROZEN_PREFIX; i++) {
+        out <<= 8;
+        if (*str != '\0') {
+            out |= (unsigned char) *str++;
+        }
+    }
+
+    return out;
+}
+
+/* 
+ * Find the leftmost node below a node of an implicit complete tree.
+ * @param e the node, numbered in Eytzinger order
+ * @param n the number of nodes in the tree
+ * @return the leftmost node of the subtree at e
+ */
+static int frozen_leftmost(int e, int n) {
+    while (2 * e <= n) {
+        e = 2 * e;
+    }
+    return e;
+}
+
+/* 
+ * Freeze a tree into a read-only array for fast searching. The keys are
+ * laid out in Eytzinger order, the order of a breadth-first walk of a
+ * complete tree, so the top levels share a few cache lines and the
+ * children of node i are always 2i and 2i + 1. The frozen tree copies
+ * the keys and does not change when the tree does.
+ * @param b the tree to freeze
+ * @return the frozen tree
+ */
+frozen_tree tree_freeze(tree b) {
+    struct tree_stack stack = {NULL, 0, 0};
+    frozen_tree f = emalloc(sizeof *f);
+    struct tree_pool *p = b == NULL ? NULL : tree_pool_of(b);
+    tree_index i = tree_index_of(b);
+    char **sorted = NULL;
+    size_t bytes = 0, len;
+    int n = 0, max = 0, k, e;
+    char *out;
+
+    /* collect the keys in order */
+    while (i != 0 || stack.size > 0) {
+        while (i != 0) {
+            stack_push(&stack, i);
+            i = NODE(p, i)->child[0];
+        }
+        i = stack_pop(&stack);
+        if (NODE(p, i)->key != NULL) {
+            if (n == max) {
+                max = max == 0 ? 1024 : 2 * max;
+                sorted = erealloc(sorted, max * sizeof sorted[0]);
+            }
+            sorted[n++] = NODE(p, i)->key;
+            bytes += strlen(NODE(p, i)->key) + 1;
+        }
+        i = NODE(p, i)->child[1];
+    }
+    free(stack.items);
+
+    f->size = n;
+    f->nodes = emalloc((n + 1) * sizeof f->nodes[0]);
+    f->keys = out = emalloc(bytes + 1);
+    f->keys_size = bytes;
+    f->map = NULL;
+    f->map_size = 0;
+    memset(&f->nodes[0], 0, sizeof f->nodes[0]);
+
+    /* visit the implicit tree in order, handing out the sorted keys */
+    for (k = 0, e = frozen_leftmost(1, n); k < n; k++) {
+        len = strlen(sorted[k]) + 1;
+        memcpy(out, sorted[k], len);
+        f->nodes[e].prefix = frozen_prefix(out);
+        f->nodes[e].key = out - f->keys;
+        out += len;
+
+        if (2 * e + 1 <= n) {
+            e = frozen_leftmost(2 * e + 1, n);
+        } else {
+            while (e & 1) {
+                e >>= 1;
+            }
+            e >>= 1;
+        }
+    }
+
+    *out = '\0';
+    free(sorted);
+
+    return f;
+}
+
+/* 
+ * Search a frozen tree. The descent decides each step from the inline
+ * prefixes alone unless they tie, and takes the child by arithmetic
+ * rather than a branch, prefetching four levels ahead as it goes. The
+ * key is only checked in full once the bottom is reached. Loading a
+ * snapshot checks only its header, so key offsets are checked against
+ * the key block here, and a node whose key lies outside it never
+ * matches.
+ * @param f the frozen tree
+ * @param str the value to search for
+ * @return 1 if the value is in the tree, 0 otherwise
+ */
+int tree_frozen_search(frozen_tree f, char *str) {
+    struct frozen_node *nodes = f->nodes;
+    char *keys = f->keys;
+    uint64_t prefix = frozen_prefix(str);
+    unsigned int i = 1, n = f->size;
+    int less, found;
+
+    while (i <= n) {
+        TREE_PREFETCH(nodes + 16 * i);
+        less = nodes[i].prefix < prefix || (nodes[i].prefix == prefix
+            && (prefix & 0xff) != 0
+            && nodes[i].key < f->keys_size
+            && f->keys_size - nodes[i].key > FROZEN_PREFIX
+            && strcmp(keys + nodes[i].key + FROZEN_PREFIX,
+                      str + FROZEN_PREFIX) < 0);
+        TREE_COUNT((frozen_counts.strcmps += nodes[i].prefix == prefix
+                    && (prefix & 0xff) != 0, frozen_depth++));
+        i = 2 * i + less;
+    }
+
+    /* undo the steps right and the final step left to find the first
+       key not less than str */
+    while (i & 1) {
+        i >>= 1;
+    }
+    i >>= 1;
+
+    TREE_COUNT(frozen_counts.strcmps += i != 0
+               && nodes[i].prefix == prefix);
+    found = i != 0 && nodes[i].prefix == prefix
+        && nodes[i].key < f->keys_size
+        && strcmp(keys + nodes[i].key, str) == 0;
+    TREE_COUNT(tree_count_search(&frozen_counts, &frozen_depth, found));
+
+    return found;
+}
+
+/* 
+ * Bytes a frozen tree takes, its node array and its packed keys.
+ * @param f the frozen tree
+ * @return the bytes
+ */
+size_t tree_frozen_memory(frozen_tree f) {
+    return (f->size + 1) * sizeof f->nodes[0] + f->keys_size + 1;
+}
+
+/* 
+ * Free a frozen tree.
+ * @param f the frozen tree to free
+ */
+void tree_frozen_free(frozen_tree f) {
+    if (f->map != NULL) {
+        unmap_file(f->map, f->map_size);
+    } else {
+        free(f->nodes);
+        free(f->keys);
+    }
+    free(f);
+}
+
+/* 
+ * Save a frozen tree to a snapshot file that tree_frozen_load can map
+ * back in. Nodes name their keys by offset, so the file is written as
+ * the tree stands in memory.
+ * @param f the frozen tree
+ * @param stream the stream to write the snapshot to
+ * @return 1 if the snapshot was written, 0 otherwise
+ */
+int tree_frozen_save(frozen_tree f, FILE *stream) {
+    struct frozen_header header;
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, FROZEN_MAGIC, sizeof header.magic);
+    header.version = FROZEN_VERSION;
+    header.byte_order = FROZEN_BYTE_ORDER;
+    header.size = f->size;
+    header.nodes_offset = sizeof header;
+    header.keys_offset = sizeof header + (f->size + 1) * sizeof f->nodes[0];
+    header.keys_size = f->keys_size + 1;
+
+    return fwrite(&header, sizeof header, 1, stream) == 1
+        && fwrite(f->nodes, sizeof f->nodes[0], f->size + 1, stream)
+            == (size_t) f->size + 1
+        && fwrite(f->keys, 1, f->keys_size + 1, stream) == f->keys_size + 1
+        && fflush(stream) == 0;
+}
+
+/* 
+ * Load a frozen tree from a snapshot file written by tree_frozen_save.
+ * The file is mapped rather than read, so loading takes the same time
+ * whatever the size of the tree, and searches run on the file in place.
+ * @param path the snapshot file
+ * @return the loaded frozen tree, or NULL if the file can't be mapped or
+ *  is not a snapshot this version understands
+ */
+frozen_tree tree_frozen_load(char *path) {
+    struct frozen_header *header;
+    size_t size;
+    char *map = map_file(path, &size);
+    frozen_tree f;
+
+    if (map == NULL) {
+        return NULL;
+    }
+
+    header = (struct frozen_header *) map;
+    if (size < sizeof *header
+            || memcmp(header->magic, FROZEN_MAGIC, sizeof header->magic) != 0
+            || header->version != FROZEN_VERSION
+            || header->byte_order != FROZEN_BYTE_ORDER
+            || header->size >= UINT32_MAX / 2
+            || header->nodes_offset != sizeof *header
+            || header->keys_offset != header->nodes_offset
+                + (header->size + 1) * sizeof(struct frozen_node)
+            || header->keys_size == 0
+            || header->keys_offset + header->keys_size != size
+            || map[size - 1] != '\0') {
+        unmap_file(map, size);
+        return NULL;
+    }
+
+    f = emalloc(sizeof *f);
+    f->nodes = (struct frozen_node *) (map + header->nodes_offset);
+    f->keys = map + header->keys_offset;
+    f->size = (int) header->size;
+    f->keys_size = header->keys_size - 1;
+    f->map = map;
+    f->map_size = size;
+
+    return f;
 }
 
 /*
@@ -223,20 +1153,31 @@ tree setColourBlack(tree b) {
 }
 
 /* 
- * Free the memory allocated to a given tree.
+ * Free the memory allocated to a given tree. The nodes live in slabs and
+ * the keys in one arena, so both are released at once without walking
+ * the tree.
  * @param b a given tree to free memory from
- * @return a tree freed from memory
+ * @return an empty tree
  */
 tree tree_free(tree b) {
-    if (b == NULL){
-        return b;
-    }else{
-        tree_free(b->left);
-        tree_free(b->right);
-        free(b->key);
-        free(b);
-        return b;
+    struct tree_pool *p;
+    int i;
+
+    if (b == NULL) {
+        return NULL;
+    }
+    p = tree_pool_of(b);
+
+    for (i = 0; i < p->num_slabs; i++) {
+        free(p->slabs[i]);
     }
+    free(p->slabs);
+    if (p->keys != NULL) {
+        arena_free(p->keys);
+    }
+    free(p);
+
+    return NULL;
 }
 
 /**
@@ -247,19 +1188,44 @@ tree tree_free(tree b) {
  * @param out the stream to write the DOT output to.
  */
 void tree_output_dot_aux(tree t, FILE *out) {
-    if(t->key != NULL) {
-        fprintf(out, "\"%s\"[label=\"{<f0>%s:%d|{<f1>|<f2>}}\"color=%s];\n",
-                t->key, t->key, t->frequency,
-                (RBT == tree_type && RED == t->colour) ? "red":"black");
-    }
-    if(t->left != NULL) {
-        tree_output_dot_aux(t->left, out);
-        fprintf(out, "\"%s\":f1 -> \"%s\":f0;\n", t->key, t->left->key);
+    struct tree_stack stack = {NULL, 0, 0};
+    tree_index i = tree_index_of(t);
+    struct tree_pool *p;
+    int stage;
+
+    if (i == 0) {
+        return;
     }
-    if(t->right != NULL) {
-        tree_output_dot_aux(t->right, out);
-        fprintf(out, "\"%s\":f2 -> \"%s\":f0;\n", t->key, t->right->key);
+    p = tree_pool_of(t);
+
+    /* Each entry is a node and how far its visit has got: 0 to print the
+       node itself, 1 to link its left child, 2 to link its right child */
+    stack_push(&stack, i);
+    stack_push(&stack, 0);
+    while (stack.size > 0) {
+        stage = stack_pop(&stack);
+        i = stack_pop(&stack);
+        t = NODE(p, i);
+
+        if (stage == 0 && t->key != NULL) {
+            fprintf(out, "\"%s\"[label=\"{<f0>%s:%d|{<f1>|<f2>}}\"color=%s];\n",
+                    t->key, t->key, t->frequency,
+                    (RBT == p->type && RED == t->colour) ? "red":"black");
+        } else if (stage > 0 && t->child[stage - 1] != 0) {
+            fprintf(out, "\"%s\":f%d -> \"%s\":f0;\n", t->key, stage,
+                    NODE(p, t->child[stage - 1])->key);
+        }
+        if (stage < 2) {
+            stack_push(&stack, i);
+            stack_push(&stack, stage + 1);
+            if (t->child[stage] != 0) {
+                stack_push(&stack, t->child[stage]);
+                stack_push(&stack, 0);
+            }
+        }
     }
+
+    free(stack.items);
 }
 
 /**
@@ -279,3 +1245,79 @@ void tree_output_dot(tree t, FILE *out) {
     tree_output_dot_aux(t, out);
     fprintf(out, "}\n");
 }
+
+/* 
+ * Copy out the operation counts of the tree, along with how many of its
+ * nodes lie at each depth.
+ * @param b the tree
+ * @param out set to the counts, all 0 when they are not kept
+ * @return 1 if the tree was built with -DINSTRUMENT, 0 otherwise
+ */
+int tree_get_counters(tree b, struct tree_counters *out) {
+#ifdef INSTRUMENT
+    struct tree_stack stack = {NULL, 0, 0};
+    tree_index i = tree_index_of(b), depth;
+    struct tree_pool *p = i == 0 ? NULL : tree_pool_of(b);
+
+    *out = frozen_counts;
+    if (p != NULL) {
+        tree_add_counts(out, &p->counts);
+    }
+
+    /* the stack holds each node under its depth */
+    if (i != 0 && b->key != NULL) {
+        stack_push(&stack, i);
+        stack_push(&stack, 0);
+    }
+    while (stack.size > 0) {
+        depth = stack_pop(&stack);
+        i = stack_pop(&stack);
+        out->node_depths[depth < TREE_DEPTH_BUCKETS
+                         ? depth : TREE_DEPTH_BUCKETS - 1]++;
+        if (NODE(p, i)->child[0] != 0) {
+            stack_push(&stack, NODE(p, i)->child[0]);
+            stack_push(&stack, depth + 1);
+        }
+        if (NODE(p, i)->child[1] != 0) {
+            stack_push(&stack, NODE(p, i)->child[1]);
+            stack_push(&stack, depth + 1);
+        }
+    }
+    free(stack.items);
+
+    return 1;
+#else
+    (void) b;
+    memset(out, 0, sizeof *out);
+    return 0;
+#endif
+}
+
+/* 
+ * Print the operation counts of the tree as a JSON object.
+ * @param b the tree
+ * @param stream the stream to print to
+ */
+void tree_print_counters(tree b, FILE *stream) {
+    struct tree_counters c;
+
+    if (!tree_get_counters(b, &c)) {
+        fprintf(stream, "{\"instrumented\": false}\n");
+        return;
+    }
+
+    fprintf(stream, "{\"instrumented\": true, \"structure\": \"%s\",\n",
+            tree_pool_of(b)->type == RBT ? "rbt" : "bst");
+    fprintf(stream, " \"inserts\": %ld, \"deletes\": %ld, \"hits\": %ld, "
+            "\"misses\": %ld, \"strcmps\": %ld, \"rotations\": %ld, "
+            "\"recolours\": %ld,\n ", c.inserts, c.deletes, c.hits, c.misses,
+            c.strcmps, c.rotations, c.recolours);
+    print_json_counts(stream, "hit_depths", c.hit_depths, TREE_DEPTH_BUCKETS);
+    fprintf(stream, ",\n ");
+    print_json_counts(stream, "miss_depths", c.miss_depths,
+                      TREE_DEPTH_BUCKETS);
+    fprintf(stream, ",\n ");
+    print_json_counts(stream, "node_depths", c.node_depths,
+                      TREE_DEPTH_BUCKETS);
+    fprintf(stream, "}\n");
+}
@@ -5,17 +5,49 @@
 
 /* Header file for tree implementation */
 typedef struct tree_node *tree;
+typedef struct frozenrec *frozen_tree;
 typedef enum { RED, BLACK } tree_colour;
 typedef enum tree_e { BST, RBT } tree_t;
 
+/* Depths of this many nodes or more share the last bucket */
+#define TREE_DEPTH_BUCKETS 64
+
+/* Operation counts the tree keeps when built with -DINSTRUMENT. Search
+   depths count the nodes a search compared against, frozen searches
+   included. Recolours count the colour flips and fix-ups of red-black
+   insertion and deletion */
+struct tree_counters {
+    long inserts;
+    long deletes;
+    long hits;
+    long misses;
+    long strcmps;
+    long rotations;
+    long recolours;
+    long hit_depths[TREE_DEPTH_BUCKETS];
+    long miss_depths[TREE_DEPTH_BUCKETS];
+    long node_depths[TREE_DEPTH_BUCKETS];
+};
+
+extern tree tree_delete(tree r, char *str);
 extern tree tree_free(tree r);
 extern void tree_inorder(tree r, void f(char *str));
 extern tree tree_insert(tree r, char *str);
+extern size_t tree_memory(tree r);
+extern tree tree_merge(tree r, tree src);
 extern tree tree_new(tree_t type);
 extern void tree_preorder(tree r, void f(int freq, char *str));
 extern int tree_search(tree r, char *key);
 extern tree setColourBlack(tree);
 extern void tree_output_dot(tree t, FILE *out);
 extern void tree_output_dot_aux(tree t, FILE *out);
+extern frozen_tree tree_freeze(tree r);
+extern int tree_frozen_search(frozen_tree f, char *key);
+extern void tree_frozen_free(frozen_tree f);
+extern size_t tree_frozen_memory(frozen_tree f);
+extern frozen_tree tree_frozen_load(char *path);
+extern int tree_frozen_save(frozen_tree f, FILE *stream);
+extern int tree_get_counters(tree r, struct tree_counters *out);
+extern void tree_print_counters(tree r, FILE *stream);
 
 #endif /* tree_h */
@@ -0,0 +1,758 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trie.h"
+#include "mylib.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define TRIE_SIMD
+#include <emmintrin.h>
+#endif
+
+/* Bytes of a node's compressed path kept in the node. Longer paths are
+   checked against a leaf below the node */
+#define TRIE_MAX_PREFIX 8
+
+/* Node types, named by how many children they have room for */
+#define TRIE_NODE4 0
+#define TRIE_NODE16 1
+#define TRIE_NODE48 2
+#define TRIE_NODE256 3
+
+/* Run a counter update only in builds made with -DINSTRUMENT, so the
+   counters cost nothing otherwise */
+#ifdef INSTRUMENT
+#define TRIE_COUNT(stmt) (stmt)
+#else
+#define TRIE_COUNT(stmt) ((void) 0)
+#endif
+
+/* Children are tagged in their low bit when they are leaves */
+#define IS_LEAF(n) (((uintptr_t) (n)) & 1)
+#define LEAF_RAW(n) ((struct trie_leaf *) ((uintptr_t) (n) & ~(uintptr_t) 1))
+#define SET_LEAF(l) ((struct trie_node *) ((uintptr_t) (l) | 1))
+
+/* The part every inner node starts with. The node stands for the bytes
+   of its parent's path, the byte that chose it, and then prefix_len
+   more bytes the keys below it all share */
+struct trie_node {
+    uint32_t prefix_len;
+    unsigned short num_children;
+    unsigned char type;
+    unsigned char prefix[TRIE_MAX_PREFIX];
+};
+
+/* A node of up to 4 children, keys sorted */
+struct trie_node4 {
+    struct trie_node n;
+    unsigned char keys[4];
+    struct trie_node *children[4];
+};
+
+/* A node of up to 16 children, keys sorted */
+struct trie_node16 {
+    struct trie_node n;
+    unsigned char keys[16];
+    struct trie_node *children[16];
+};
+
+/* A node of up to 48 children, index holds 1 + the slot of the child for
+   each byte, 0 for none */
+struct trie_node48 {
+    struct trie_node n;
+    unsigned char index[256];
+    struct trie_node *children[48];
+};
+
+/* A node with a child slot for every byte */
+struct trie_node256 {
+    struct trie_node n;
+    struct trie_node *children[256];
+};
+
+/* A word and its frequency. The word's nul is part of the key, so no key
+   is a prefix of another and every word ends at a leaf */
+struct trie_leaf {
+    int frequency;
+    unsigned int len;
+    char key[1];
+};
+
+/* A node given back when it grew into a larger one */
+struct trie_free {
+    struct trie_free *next;
+};
+
+/* Generate trie struct. Nodes and leaves come from one arena, nodes that
+   grew are kept for reuse by the next node of their type */
+struct trierec {
+    struct trie_node *root;
+    arena store;
+    struct trie_free *free_nodes[4];
+    size_t bytes;
+#ifdef INSTRUMENT
+    struct trie_counters counters;
+#endif
+};
+
+/* Sizes of the node types */
+static const size_t trie_node_sizes[4] = {
+    sizeof(struct trie_node4), sizeof(struct trie_node16),
+    sizeof(struct trie_node48), sizeof(struct trie_node256)
+};
+
+/* 
+ * Create an empty trie.
+ * @return the new trie
+ */
+trie trie_new(void) {
+    trie t = emalloc(sizeof *t);
+
+    t->root = NULL;
+    t->store = arena_new();
+    t->free_nodes[0] = t->free_nodes[1] = NULL;
+    t->free_nodes[2] = t->free_nodes[3] = NULL;
+    t->bytes = 0;
+    TRIE_COUNT(memset(&t->counters, 0, sizeof t->counters));
+
+    return t;
+}
+
+/* 
+ * Allocate an empty inner node, reusing one of the same type if a node
+ * has grown out of one.
+ * @param t the trie
+ * @param type the type of node
+ * @return the node, with no prefix and no children
+ */
+static struct trie_node *trie_alloc_node(trie t, int type) {
+    struct trie_node *n;
+
+    if (t->free_nodes[type] != NULL) {
+        n = (struct trie_node *) t->free_nodes[type];
+        t->free_nodes[type] = t->free_nodes[type]->next;
+    } else {
+        n = arena_alloc(t->store, trie_node_sizes[type]);
+        t->bytes += trie_node_sizes[type];
+    }
+    memset(n, 0, trie_node_sizes[type]);
+    n->type = (unsigned char) type;
+    TRIE_COUNT(t->counters.nodes[type]++);
+
+    return n;
+}
+
+/* 
+ * Give back a node that has grown into a larger one.
+ * @param t the trie
+ * @param n the node
+ */
+static void trie_release_node(trie t, struct trie_node *n) {
+    struct trie_free *f = (struct trie_free *) n;
+
+    TRIE_COUNT((t->counters.nodes[n->type]--, t->counters.grows++));
+    f->next = t->free_nodes[n->type];
+    t->free_nodes[n->type] = f;
+}
+
+/* 
+ * Allocate a leaf for a word, seen once.
+ * @param t the trie
+ * @param key the word
+ * @param len the length of the word, with its nul
+ * @return the leaf
+ */
+static struct trie_leaf *trie_new_leaf(trie t, char *key, size_t len) {
+    size_t size = offsetof(struct trie_leaf, key) + len;
+    struct trie_leaf *l = arena_alloc(t->store, size);
+
+    t->bytes += size;
+    l->frequency = 1;
+    l->len = (unsigned int) len;
+    memcpy(l->key, key, len);
+
+    return l;
+}
+
+/* 
+ * Find the child of a node for a byte.
+ * @param n the node
+ * @param c the byte
+ * @return where the child is held, or NULL if there is none
+ */
+static struct trie_node **trie_find_child(struct trie_node *n,
+                                          unsigned char c) {
+    struct trie_node4 *n4;
+    struct trie_node16 *n16;
+    struct trie_node48 *n48;
+    struct trie_node256 *n256;
+    int i;
+
+    switch (n->type) {
+        case TRIE_NODE4:
+            n4 = (struct trie_node4 *) n;
+            for (i = 0; i < n->num_children; i++) {
+                if (n4->keys[i] == c) {
+                    return &n4->children[i];
+                }
+            }
+            break;
+        case TRIE_NODE16:
+            n16 = (struct trie_node16 *) n;
+#ifdef TRIE_SIMD
+            {
+                __m128i hits = _mm_cmpeq_epi8(_mm_set1_epi8((char) c),
+                    _mm_loadu_si128((__m128i *) n16->keys));
+                unsigned int bits = (unsigned int) _mm_movemask_epi8(hits)
+                    & ((1u << n->num_children) - 1);
+
+                if (bits != 0) {
+                    return &n16->children[__builtin_ctz(bits)];
+                }
+            }
+#else
+            for (i = 0; i < n->num_children; i++) {
+                if (n16->keys[i] == c) {
+                    return &n16->children[i];
+                }
+            }
+#endif
+            break;
+        case TRIE_NODE48:
+            n48 = (struct trie_node48 *) n;
+            if (n48->index[c] != 0) {
+                return &n48->children[n48->index[c] - 1];
+            }
+            break;
+        default:
+            n256 = (struct trie_node256 *) n;
+            if (n256->children[c] != NULL) {
+                return &n256->children[c];
+            }
+            break;
+    }
+
+    return NULL;
+}
+
+/* 
+ * Find the leaf of the smallest key below a node.
+ * @param n the node, or a tagged leaf
+ * @return the leaf
+ */
+static struct trie_leaf *trie_minimum(struct trie_node *n) {
+    struct trie_node48 *n48;
+    struct trie_node256 *n256;
+    int i;
+
+    while (!IS_LEAF(n)) {
+        switch (n->type) {
+            case TRIE_NODE4:
+                n = ((struct trie_node4 *) n)->children[0];
+                break;
+            case TRIE_NODE16:
+                n = ((struct trie_node16 *) n)->children[0];
+                break;
+            case TRIE_NODE48:
+                n48 = (struct trie_node48 *) n;
+                for (i = 0; n48->index[i] == 0; i++) {
+                    continue;
+                }
+                n = n48->children[n48->index[i] - 1];
+                break;
+            default:
+                n256 = (struct trie_node256 *) n;
+                for (i = 0; n256->children[i] == NULL; i++) {
+                    continue;
+                }
+                n = n256->children[i];
+                break;
+        }
+    }
+
+    return LEAF_RAW(n);
+}
+
+/* 
+ * Add a child to a node of up to 4 or 16 children, which has room for
+ * it, keeping the keys sorted.
+ * @param keys the keys of the node
+ * @param children the children of the node
+ * @param n the node
+ * @param c the byte of the child
+ * @param child the child
+ */
+static void trie_add_sorted(unsigned char *keys, struct trie_node **children,
+                            struct trie_node *n, unsigned char c,
+                            struct trie_node *child) {
+    int i;
+
+    for (i = n->num_children; i > 0 && keys[i - 1] > c; i--) {
+        keys[i] = keys[i - 1];
+        children[i] = children[i - 1];
+    }
+    keys[i] = c;
+    children[i] = child;
+    n->num_children++;
+}
+
+/* 
+ * Copy the header of a node into the larger node it grows into.
+ * @param to the larger node
+ * @param from the node that grew
+ */
+static void trie_copy_header(struct trie_node *to, struct trie_node *from) {
+    to->prefix_len = from->prefix_len;
+    to->num_children = from->num_children;
+    memcpy(to->prefix, from->prefix, TRIE_MAX_PREFIX);
+}
+
+/* 
+ * Add a child to a node, growing the node into the next larger type
+ * when it is full.
+ * @param t the trie
+ * @param n the node
+ * @param ref where the node is held, updated if it grows
+ * @param c the byte of the child, which the node has no child for
+ * @param child the child
+ */
+static void trie_add_child(trie t, struct trie_node *n,
+                           struct trie_node **ref, unsigned char c,
+                           struct trie_node *child) {
+    struct trie_node4 *n4;
+    struct trie_node16 *n16;
+    struct trie_node48 *n48;
+    struct trie_node256 *n256;
+    int i;
+
+    switch (n->type) {
+        case TRIE_NODE4:
+            n4 = (struct trie_node4 *) n;
+            if (n->num_children < 4) {
+                trie_add_sorted(n4->keys, n4->children, n, c, child);
+                return;
+            }
+            n16 = (struct trie_node16 *) trie_alloc_node(t, TRIE_NODE16);
+            trie_copy_header(&n16->n, n);
+            memcpy(n16->keys, n4->keys, sizeof n4->keys);
+            memcpy(n16->children, n4->children, sizeof n4->children);
+            *ref = &n16->n;
+            trie_release_node(t, n);
+            trie_add_sorted(n16->keys, n16->children, &n16->n, c, child);
+            return;
+        case TRIE_NODE16:
+            n16 = (struct trie_node16 *) n;
+            if (n->num_children < 16) {
+                trie_add_sorted(n16->keys, n16->children, n, c, child);
+                return;
+            }
+            n48 = (struct trie_node48 *) trie_alloc_node(t, TRIE_NODE48);
+            trie_copy_header(&n48->n, n);
+            memcpy(n48->children, n16->children, sizeof n16->children);
+            for (i = 0; i < 16; i++) {
+                n48->index[n16->keys[i]] = (unsigned char) (i + 1);
+            }
+            *ref = &n48->n;
+            trie_release_node(t, n);
+            n = &n48->n;
+            /* fall through */
+        case TRIE_NODE48:
+            n48 = (struct trie_node48 *) n;
+            if (n->num_children < 48) {
+                for (i = 0; n48->children[i] != NULL; i++) {
+                    continue;
+                }
+                n48->children[i] = child;
+                n48->index[c] = (unsigned char) (i + 1);
+                n->num_children++;
+                return;
+            }
+            n256 = (struct trie_node256 *) trie_alloc_node(t, TRIE_NODE256);
+            trie_copy_header(&n256->n, n);
+            for (i = 0; i < 256; i++) {
+                if (n48->index[i] != 0) {
+                    n256->children[i] = n48->children[n48->index[i] - 1];
+                }
+            }
+            *ref = &n256->n;
+            trie_release_node(t, n);
+            n = &n256->n;
+            /* fall through */
+        default:
+            n256 = (struct trie_node256 *) n;
+            n256->children[c] = child;
+            n->num_children++;
+            return;
+    }
+}
+
+/* 
+ * Count how many bytes of a key match the compressed path of a node,
+ * going by the bytes kept in the node only.
+ * @param n the node
+ * @param key the key
+ * @param len the length of the key
+ * @param depth the bytes of the key the path starts after
+ * @return the number of matching bytes
+ */
+static int trie_check_prefix(struct trie_node *n, unsigned char *key,
+                             int len, int depth) {
+    int max = (int) n->prefix_len < TRIE_MAX_PREFIX ? (int) n->prefix_len
+        : TRIE_MAX_PREFIX;
+    int i;
+
+    if (max > len - depth) {
+        max = len - depth;
+    }
+    for (i = 0; i < max && n->prefix[i] == key[depth + i]; i++) {
+        continue;
+    }
+
+    return i;
+}
+
+/* 
+ * Find where a key leaves the compressed path of a node, looking past
+ * the bytes kept in the node at a leaf below it when the path is long.
+ * @param n the node
+ * @param key the key
+ * @param len the length of the key
+ * @param depth the bytes of the key the path starts after
+ * @return the number of matching bytes
+ */
+static int trie_prefix_mismatch(struct trie_node *n, unsigned char *key,
+                                int len, int depth) {
+    int i = trie_check_prefix(n, key, len, depth), max;
+    struct trie_leaf *l;
+
+    if (i == TRIE_MAX_PREFIX && (int) n->prefix_len > TRIE_MAX_PREFIX) {
+        l = trie_minimum(n);
+        max = ((int) l->len < len ? (int) l->len : len) - depth;
+        if (max > (int) n->prefix_len) {
+            max = (int) n->prefix_len;
+        }
+        for (; i < max
+               && (unsigned char) l->key[depth + i] == key[depth + i]; i++) {
+            continue;
+        }
+    }
+
+    return i;
+}
+
+#ifdef INSTRUMENT
+/* 
+ * Count the outcome of a search and the inner nodes it passed through.
+ * @param t the trie
+ * @param found whether the word was found
+ * @param nodes the inner nodes passed through
+ */
+static void trie_count_search(trie t, int found, int nodes) {
+    if (nodes >= TRIE_DEPTH_BUCKETS) {
+        nodes = TRIE_DEPTH_BUCKETS - 1;
+    }
+    if (found) {
+        t->counters.hits++;
+        t->counters.hit_depths[nodes]++;
+    } else {
+        t->counters.misses++;
+        t->counters.miss_depths[nodes]++;
+    }
+}
+#endif
+
+/* 
+ * Search a trie for a word. Each node costs a few byte compares and at
+ * most one cache miss, and the whole word is compared once, at the leaf.
+ * @param t the trie
+ * @param str the word
+ * @return the frequency of the word, 0 if it is not in the trie
+ */
+int trie_search(trie t, char *str) {
+    unsigned char *key = (unsigned char *) str;
+    int len = (int) strlen(str) + 1, depth = 0, max, freq = 0;
+    struct trie_node *n = t->root, **child;
+    struct trie_leaf *l;
+#ifdef INSTRUMENT
+    int nodes = 0;
+#endif
+
+    while (n != NULL) {
+        if (IS_LEAF(n)) {
+            l = LEAF_RAW(n);
+            if ((int) l->len == len && memcmp(l->key, str, len) == 0) {
+                freq = l->frequency;
+            }
+            break;
+        }
+        TRIE_COUNT(nodes++);
+        if (n->prefix_len != 0) {
+            max = (int) n->prefix_len < TRIE_MAX_PREFIX ? (int) n->prefix_len
+                : TRIE_MAX_PREFIX;
+            if (trie_check_prefix(n, key, len, depth) != max) {
+                break;
+            }
+            /* bytes of the path past those kept are checked at the leaf */
+            depth += n->prefix_len;
+        }
+        if (depth >= len) {
+            break;
+        }
+        child = trie_find_child(n, key[depth]);
+        n = child != NULL ? *child : NULL;
+        depth++;
+    }
+
+    TRIE_COUNT(trie_count_search(t, freq > 0, nodes));
+    return freq;
+}
+
+/* 
+ * Add an occurrence of a word below a node.
+ * @param t the trie
+ * @param n the node, a tagged leaf or NULL
+ * @param ref where the node is held
+ * @param key the word
+ * @param len the length of the word, with its nul
+ * @param depth the bytes of the word the node's path starts after
+ */
+static void trie_insert_at(trie t, struct trie_node *n,
+                           struct trie_node **ref, unsigned char *key,
+                           int len, int depth) {
+    struct trie_node **child;
+    struct trie_node *split;
+    struct trie_leaf *l, *leaf;
+    int i, diff;
+
+    for (;;) {
+        if (n == NULL) {
+            *ref = SET_LEAF(trie_new_leaf(t, (char *) key, len));
+            return;
+        }
+
+        if (IS_LEAF(n)) {
+            l = LEAF_RAW(n);
+            if ((int) l->len == len && memcmp(l->key, key, len) == 0) {
+                l->frequency++;
+                return;
+            }
+
+            /* two leaves now, under a node for the path they share */
+            leaf = trie_new_leaf(t, (char *) key, len);
+            for (i = depth; (unsigned char) l->key[i] == key[i]; i++) {
+                continue;
+            }
+            split = trie_alloc_node(t, TRIE_NODE4);
+            TRIE_COUNT(t->counters.splits++);
+            split->prefix_len = (uint32_t) (i - depth);
+            memcpy(split->prefix, key + depth,
+                   i - depth < TRIE_MAX_PREFIX ? i - depth : TRIE_MAX_PREFIX);
+            trie_add_child(t, split, ref, (unsigned char) l->key[i], n);
+            trie_add_child(t, split, ref, key[i], SET_LEAF(leaf));
+            *ref = split;
+            return;
+        }
+
+        if (n->prefix_len != 0) {
+            diff = trie_prefix_mismatch(n, key, len, depth);
+            if (diff < (int) n->prefix_len) {
+                /* the word leaves the path part way, so split it there */
+                split = trie_alloc_node(t, TRIE_NODE4);
+                TRIE_COUNT(t->counters.splits++);
+                split->prefix_len = (uint32_t) diff;
+                memcpy(split->prefix, n->prefix,
+                       diff < TRIE_MAX_PREFIX ? diff : TRIE_MAX_PREFIX);
+                if (n->prefix_len <= TRIE_MAX_PREFIX) {
+                    trie_add_child(t, split, ref, n->prefix[diff], n);
+                    n->prefix_len -= diff + 1;
+                    memmove(n->prefix, n->prefix + diff + 1, n->prefix_len);
+                } else {
+                    n->prefix_len -= diff + 1;
+                    l = trie_minimum(n);
+                    trie_add_child(t, split, ref,
+                                   (unsigned char) l->key[depth + diff], n);
+                    memcpy(n->prefix, l->key + depth + diff + 1,
+                           n->prefix_len < TRIE_MAX_PREFIX ? n->prefix_len
+                           : TRIE_MAX_PREFIX);
+                }
+                leaf = trie_new_leaf(t, (char *) key, len);
+                trie_add_child(t, split, ref, key[depth + diff],
+                               SET_LEAF(leaf));
+                *ref = split;
+                return;
+            }
+            depth += n->prefix_len;
+        }
+
+        child = trie_find_child(n, key[depth]);
+        if (child == NULL) {
+            leaf = trie_new_leaf(t, (char *) key, len);
+            trie_add_child(t, n, ref, key[depth], SET_LEAF(leaf));
+            return;
+        }
+        ref = child;
+        n = *child;
+        depth++;
+    }
+}
+
+/* 
+ * Add an occurrence of a word to a trie. Inner nodes come in four
+ * sizes and grow from one to the next as children are added, and a
+ * chain of nodes with one child each is kept as a path in the node
+ * below it, so a word costs at most one node per byte and usually far
+ * fewer.
+ * @param t the trie
+ * @param str the word
+ * @return the trie
+ */
+trie trie_insert(trie t, char *str) {
+    TRIE_COUNT(t->counters.inserts++);
+    trie_insert_at(t, t->root, &t->root, (unsigned char *) str,
+                   (int) strlen(str) + 1, 0);
+
+    return t;
+}
+
+/* 
+ * Visit the leaves below a node in key order.
+ * @param n the node, or a tagged leaf
+ * @param f the function to call with each word and its frequency
+ * @param g the function to call with each word, if f is NULL
+ */
+static void trie_walk(struct trie_node *n, void f(int freq, char *str),
+                      void g(char *str)) {
+    struct trie_node4 *n4;
+    struct trie_node16 *n16;
+    struct trie_node48 *n48;
+    struct trie_node256 *n256;
+    struct trie_leaf *l;
+    int i;
+
+    if (IS_LEAF(n)) {
+        l = LEAF_RAW(n);
+        if (f != NULL) {
+            f(l->frequency, l->key);
+        } else {
+            g(l->key);
+        }
+        return;
+    }
+
+    switch (n->type) {
+        case TRIE_NODE4:
+            n4 = (struct trie_node4 *) n;
+            for (i = 0; i < n->num_children; i++) {
+                trie_walk(n4->children[i], f, g);
+            }
+            break;
+        case TRIE_NODE16:
+            n16 = (struct trie_node16 *) n;
+            for (i = 0; i < n->num_children; i++) {
+                trie_walk(n16->children[i], f, g);
+            }
+            break;
+        case TRIE_NODE48:
+            n48 = (struct trie_node48 *) n;
+            for (i = 0; i < 256; i++) {
+                if (n48->index[i] != 0) {
+                    trie_walk(n48->children[n48->index[i] - 1], f, g);
+                }
+            }
+            break;
+        default:
+            n256 = (struct trie_node256 *) n;
+            for (i = 0; i < 256; i++) {
+                if (n256->children[i] != NULL) {
+                    trie_walk(n256->children[i], f, g);
+                }
+            }
+            break;
+    }
+}
+
+/* 
+ * Visit the words of a trie with their frequencies. Children are kept
+ * in byte order, so the words come out sorted as strcmp sorts them.
+ * @param t the trie
+ * @param f the function to call with each word
+ */
+void trie_preorder(trie t, void f(int freq, char *str)) {
+    if (t->root != NULL) {
+        trie_walk(t->root, f, NULL);
+    }
+}
+
+/* 
+ * Visit the words of a trie in sorted order.
+ * @param t the trie
+ * @param f the function to call with each word
+ */
+void trie_inorder(trie t, void f(char *str)) {
+    if (t->root != NULL) {
+        trie_walk(t->root, NULL, f);
+    }
+}
+
+/* 
+ * Bytes of memory a trie takes for its nodes and leaves.
+ * @param t the trie
+ * @return the number of bytes
+ */
+size_t trie_memory(trie t) {
+    return t->bytes;
+}
+
+/* 
+ * Copy out the operation counts of a trie.
+ * @param t the trie
+ * @param out set to the counts, all 0 when they are not kept
+ * @return 1 if the trie was built with -DINSTRUMENT, 0 otherwise
+ */
+int trie_get_counters(trie t, struct trie_counters *out) {
+#ifdef INSTRUMENT
+    *out = t->counters;
+    return 1;
+#else
+    (void) t;
+    memset(out, 0, sizeof *out);
+    return 0;
+#endif
+}
+
+/* 
+ * Print the operation counts of a trie as a JSON object.
+ * @param t the trie
+ * @param stream the stream to print to
+ */
+void trie_print_counters(trie t, FILE *stream) {
+    struct trie_counters c;
+
+    if (!trie_get_counters(t, &c)) {
+        fprintf(stream, "{\"instrumented\": false}\n");
+        return;
+    }
+
+    fprintf(stream, "{\"instrumented\": true, \"structure\": \"art\",\n");
+    fprintf(stream, " \"inserts\": %ld, \"hits\": %ld, \"misses\": %ld, "
+            "\"splits\": %ld, \"grows\": %ld, \"bytes\": %lu,\n ",
+            c.inserts, c.hits, c.misses, c.splits, c.grows,
+            (unsigned long) t->bytes);
+    print_json_counts(stream, "nodes", c.nodes, 4);
+    fprintf(stream, ",\n ");
+    print_json_counts(stream, "hit_depths", c.hit_depths, TRIE_DEPTH_BUCKETS);
+    fprintf(stream, ",\n ");
+    print_json_counts(stream, "miss_depths", c.miss_depths,
+                      TRIE_DEPTH_BUCKETS);
+    fprintf(stream, "}\n");
+}
+
+/* 
+ * Free a trie and every word in it.
+ * @param t the trie to free
+ */
+void trie_free(trie t) {
+    arena_free(t->store);
+    free(t);
+}
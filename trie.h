@@ -0,0 +1,37 @@
+#ifndef TRIE_H_
+#define TRIE_H_
+
+#include <stdio.h>
+
+/* Header file for adaptive radix trie implementation */
+typedef struct trierec *trie;
+
+/* Depths of this many inner nodes or more share the last bucket */
+#define TRIE_DEPTH_BUCKETS 32
+
+/* Operation counts the trie keeps when built with -DINSTRUMENT. Search
+   depths count the inner nodes a search passed through. Splits count
+   the nodes made where two words part, grows the nodes that moved up
+   to a larger type, and nodes the inner nodes of each type in use */
+struct trie_counters {
+    long inserts;
+    long hits;
+    long misses;
+    long splits;
+    long grows;
+    long nodes[4];
+    long hit_depths[TRIE_DEPTH_BUCKETS];
+    long miss_depths[TRIE_DEPTH_BUCKETS];
+};
+
+extern void trie_free(trie t);
+extern int trie_get_counters(trie t, struct trie_counters *out);
+extern void trie_inorder(trie t, void f(char *str));
+extern trie trie_insert(trie t, char *str);
+extern size_t trie_memory(trie t);
+extern trie trie_new(void);
+extern void trie_preorder(trie t, void f(int freq, char *str));
+extern void trie_print_counters(trie t, FILE *stream);
+extern int trie_search(trie t, char *str);
+
+#endif
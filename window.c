@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "window.h"
+#include "mylib.h"
+
+/* Bytes of text a window starts with room for */
+#define WINDOW_INITIAL_TEXT 4096
+
+/* Words a window starts with room for, a power of two */
+#define WINDOW_INITIAL_WORDS 256
+
+/* A word in a window, where its copy starts in the text ring and when
+   it arrived */
+struct window_entry {
+    size_t offset;
+    double time;
+};
+
+/* Generate window struct. The words in the window are kept oldest
+   first in two rings: entries, from head on, and the text they point
+   into, from the oldest entry's offset up to tail, wrapping round to
+   the start of the text at most once */
+struct windowrec {
+    htable counts;
+    long max_words;
+    double max_age;
+    char *text;
+    size_t text_size;
+    size_t tail;
+    struct window_entry *entries;
+    long capacity;
+    long head;
+    long num_words;
+};
+
+/* 
+ * Create a sliding window over a stream of words. Words are counted in
+ * a hash table as they arrive and taken out of it again as they leave,
+ * so the table always holds the counts of just the words in the window.
+ * @param counts the hash table to count in, which should be able to grow
+ * @param max_words the most words the window holds, 0 for no limit
+ * @param max_age the most seconds a word stays in the window, 0 for no
+ *  limit
+ * @return the new, empty window
+ */
+window window_new(htable counts, long max_words, double max_age) {
+    window w = emalloc(sizeof *w);
+
+    w->counts = counts;
+    w->max_words = max_words > 0 ? max_words : 0;
+    w->max_age = max_age > 0.0 ? max_age : 0.0;
+    w->text_size = WINDOW_INITIAL_TEXT;
+    w->text = emalloc(w->text_size);
+    w->tail = 0;
+    w->capacity = WINDOW_INITIAL_WORDS;
+    w->entries = emalloc(w->capacity * sizeof w->entries[0]);
+    w->head = 0;
+    w->num_words = 0;
+
+    return w;
+}
+
+/* 
+ * Make room for more text in a window by copying the words in it, oldest
+ * first, to the start of a text ring at least twice the size.
+ * @param w the window
+ * @param need the bytes that must fit after the words
+ */
+static void window_grow_text(window w, size_t need) {
+    size_t size = 2 * w->text_size + need, pos = 0, len;
+    char *text = emalloc(size);
+    struct window_entry *e;
+    long i;
+
+    for (i = 0; i < w->num_words; i++) {
+        e = &w->entries[(w->head + i) & (w->capacity - 1)];
+        len = strlen(w->text + e->offset) + 1;
+        memcpy(text + pos, w->text + e->offset, len);
+        e->offset = pos;
+        pos += len;
+    }
+
+    free(w->text);
+    w->text = text;
+    w->text_size = size;
+    w->tail = pos;
+}
+
+/* 
+ * Find room for a word at the end of a window's text ring, wrapping
+ * round to the start when the end is full and the oldest word has moved
+ * far enough along, and growing the ring when neither fits.
+ * @param w the window
+ * @param need the bytes of the word, with its nul
+ * @return the offset to copy the word to
+ */
+static size_t window_reserve(window w, size_t need) {
+    size_t first;
+
+    if (w->num_words == 0) {
+        w->tail = 0;
+    } else {
+        first = w->entries[w->head].offset;
+        if (first < w->tail) { /* text runs from first to tail */
+            if (w->tail + need > w->text_size) {
+                if (need <= first) {
+                    w->tail = 0;
+                } else {
+                    window_grow_text(w, need);
+                }
+            }
+        } else if (w->tail + need > first) { /* text has wrapped */
+            window_grow_text(w, need);
+        }
+    }
+    if (w->tail + need > w->text_size) {
+        window_grow_text(w, need);
+    }
+
+    w->tail += need;
+    return w->tail - need;
+}
+
+/* 
+ * Take the oldest word out of a window and out of its counts.
+ * @param w the window, which must not be empty
+ */
+static void window_evict(window w) {
+    htable_decrement(w->counts, w->text + w->entries[w->head].offset);
+    w->head = (w->head + 1) & (w->capacity - 1);
+    w->num_words--;
+}
+
+/* 
+ * Add a word to a window, and take out whatever the window no longer
+ * has room for. Each word is copied once in and looked up once on the
+ * way in and once on the way out, however large the window is.
+ * @param w the window
+ * @param word the word
+ * @param now the time the word arrived, in seconds, which must not be
+ *  before the time of the word added last
+ */
+void window_add(window w, char *word, double now) {
+    size_t need = strlen(word) + 1;
+    struct window_entry *e;
+    struct window_entry *entries;
+    long i;
+
+    if (w->num_words == w->capacity) {
+        entries = emalloc(2 * w->capacity * sizeof entries[0]);
+        for (i = 0; i < w->num_words; i++) {
+            entries[i] = w->entries[(w->head + i) & (w->capacity - 1)];
+        }
+        free(w->entries);
+        w->entries = entries;
+        w->capacity *= 2;
+        w->head = 0;
+    }
+
+    e = &w->entries[(w->head + w->num_words) & (w->capacity - 1)];
+    e->offset = window_reserve(w, need);
+    e->time = now;
+    memcpy(w->text + e->offset, word, need);
+    w->num_words++;
+    htable_insert(w->counts, word);
+
+    if (w->max_words > 0 && w->num_words > w->max_words) {
+        window_evict(w);
+    }
+    window_expire(w, now);
+}
+
+/* 
+ * Take the words out of a window that are older than it allows.
+ * @param w the window
+ * @param now the time in seconds
+ */
+void window_expire(window w, double now) {
+    if (w->max_age > 0.0) {
+        while (w->num_words > 0
+               && w->entries[w->head].time <= now - w->max_age) {
+            window_evict(w);
+        }
+    }
+}
+
+/* 
+ * Number of words in a window.
+ * @param w the window
+ * @return the number of words counted and not yet taken out again
+ */
+long window_size(window w) {
+    return w->num_words;
+}
+
+/* 
+ * Free a window, leaving the hash table it counts in alone.
+ * @param w the window to free
+ */
+void window_free(window w) {
+    free(w->text);
+    free(w->entries);
+    free(w);
+}
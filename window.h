@@ -0,0 +1,15 @@
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+#include "htable.h"
+
+/* Header file for sliding window implementation */
+typedef struct windowrec *window;
+
+extern void window_add(window w, char *word, double now);
+extern void window_expire(window w, double now);
+extern void window_free(window w);
+extern window window_new(htable counts, long max_words, double max_age);
+extern long window_size(window w);
+
+#endif